@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
@@ -11,6 +12,9 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sectors read ahead at once for sequentially read inode. */
+#define RA_SECTORS 8
+
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
@@ -35,6 +39,14 @@ struct inode {
 	int deny_write_cnt;		 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;  /* Inode content. */
 	struct lock inoode_lock; /* Lock for shared variable like open_cnt */
+
+	/* Readahead, protected by inoode_lock. */
+	int advice;				/* FADV_NORMAL, FADV_RANDOM or FADV_SEQUENTIAL */
+	off_t advice_ofs;		/* Byte range ADVICE applies to, */
+	off_t advice_len;		/* 0 length means up to end of file */
+	uint8_t *ra_buf;		/* RA_SECTORS sectors, NULL if not allocated */
+	disk_sector_t ra_start; /* First sector in ra_buf */
+	size_t ra_cnt;			/* Number of valid sectors in ra_buf */
 };
 
 /* Returns the disk sector that contains byte offset POS within
@@ -129,6 +141,10 @@ struct inode *inode_open(disk_sector_t sector) {
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
 	lock_init(&inode->inoode_lock);
+	inode->advice = FADV_NORMAL;
+	inode->advice_ofs = inode->advice_len = 0;
+	inode->ra_buf = NULL;
+	inode->ra_cnt = 0;
 	disk_read(filesys_disk, inode->sector, &inode->data);
 	lock_release(&open_inodes_lock);
 	return inode;
@@ -172,6 +188,7 @@ void inode_close(struct inode *inode) {
 		}
 
 		lock_release(&inode->inoode_lock);
+		free(inode->ra_buf);
 		free(inode);
 	} else {
 		lock_release(&inode->inoode_lock);
@@ -186,6 +203,92 @@ void inode_remove(struct inode *inode) {
 	inode->removed = true;
 }
 
+/* Returns advice of INODE at byte POS. Need inoode_lock before call this,
+ * or take the result as a hint. */
+static int inode_advice_at(const struct inode *inode, off_t pos) {
+	if (pos < inode->advice_ofs ||
+		(inode->advice_len && pos - inode->advice_ofs >= inode->advice_len)) {
+		return FADV_NORMAL;
+	}
+	return inode->advice;
+}
+
+/* Fill readahead window of INODE with up to CNT sectors from SECTOR_IDX.
+ * The disk is read without inoode_lock into a new buffer, which replaces
+ * the window afterwards, so readers of the window do not wait for it. */
+static bool inode_ra_fill(struct inode *inode, disk_sector_t sector_idx,
+						  size_t cnt) {
+	disk_sector_t end =
+		inode->data.start + bytes_to_sectors(inode->data.length);
+	uint8_t *buf;
+
+	if (sector_idx < inode->data.start || sector_idx >= end) {
+		return false;
+	}
+	if (cnt > RA_SECTORS) {
+		cnt = RA_SECTORS;
+	}
+	if (cnt > end - sector_idx) {
+		cnt = end - sector_idx;
+	}
+	if (!(buf = malloc(RA_SECTORS * DISK_SECTOR_SIZE))) {
+		return false;
+	}
+	for (size_t i = 0; i < cnt; ++i) {
+		disk_read(filesys_disk, sector_idx + i, buf + DISK_SECTOR_SIZE * i);
+	}
+	lock_acquire(&inode->inoode_lock);
+	free(inode->ra_buf);
+	inode->ra_buf = buf;
+	inode->ra_start = sector_idx;
+	inode->ra_cnt = cnt;
+	lock_release(&inode->inoode_lock);
+	return true;
+}
+
+/* Copy CHUNK_SIZE bytes at SECTOR_OFS of SECTOR_IDX into BUFFER from
+ * readahead window of INODE. Return true if it was in the window. Need
+ * inoode_lock before call this */
+static bool inode_ra_copy(struct inode *inode, disk_sector_t sector_idx,
+						  int sector_ofs, void *buffer, int chunk_size) {
+	if (!inode->ra_cnt || sector_idx < inode->ra_start ||
+		sector_idx >= inode->ra_start + inode->ra_cnt) {
+		return false;
+	}
+	memcpy(buffer,
+		   inode->ra_buf + DISK_SECTOR_SIZE * (sector_idx - inode->ra_start) +
+			   sector_ofs,
+		   chunk_size);
+	return true;
+}
+
+/* Copy CHUNK_SIZE bytes at SECTOR_OFS of SECTOR_IDX, byte POS of INODE,
+ * into BUFFER from readahead window of INODE. Sequentially read range moves
+ * the window forward on miss. Return false if the caller should read the
+ * disk. */
+static bool inode_ra_read(struct inode *inode, off_t pos,
+						  disk_sector_t sector_idx, int sector_ofs,
+						  void *buffer, int chunk_size) {
+	bool is_hit, is_seq;
+
+	/* Not worth the lock for inode never advised */
+	if (!inode->ra_buf && inode->advice != FADV_SEQUENTIAL) {
+		return false;
+	}
+	lock_acquire(&inode->inoode_lock);
+	is_hit = inode_ra_copy(inode, sector_idx, sector_ofs, buffer, chunk_size);
+	is_seq = inode_advice_at(inode, pos) == FADV_SEQUENTIAL;
+	lock_release(&inode->inoode_lock);
+	if (is_hit || !is_seq || !inode_ra_fill(inode, sector_idx, RA_SECTORS)) {
+		return is_hit;
+	}
+	/* Window may be moved by others meanwhile */
+	lock_acquire(&inode->inoode_lock);
+	is_hit = inode_ra_copy(inode, sector_idx, sector_ofs, buffer, chunk_size);
+	lock_release(&inode->inoode_lock);
+	return is_hit;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
  * than SIZE if an error occurs or end of file is reached. */
@@ -210,7 +313,10 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+		if (inode_ra_read(inode, offset, sector_idx, sector_ofs,
+						  buffer + bytes_read, chunk_size)) {
+			/* Copied from readahead window. */
+		} else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Read full sector directly into caller's buffer. */
 			disk_read(filesys_disk, sector_idx, buffer + bytes_read);
 		} else {
@@ -292,6 +398,12 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
 		bytes_written += chunk_size;
 	}
 	free(bounce);
+	/* Readahead window filled while writing may be stale */
+	if (bytes_written > 0) {
+		lock_acquire(&inode->inoode_lock);
+		inode->ra_cnt = 0;
+		lock_release(&inode->inoode_lock);
+	}
 
 	return bytes_written;
 }
@@ -316,5 +428,50 @@ void inode_allow_write(struct inode *inode) {
 	lock_release(&inode->inoode_lock);
 }
 
+/* Record ADVICE, one of FADV_*, on how LENGTH bytes of INODE from OFFSET
+ * are going to be read. 0 LENGTH means up to end of file. Access pattern
+ * is kept for one range, the last one given. FADV_WILLNEED reads ahead
+ * the start of the range now and FADV_DONTNEED drops the readahead window
+ * if it overlaps the range. */
+void inode_advise(struct inode *inode, off_t offset, off_t length,
+				  int advice) {
+	disk_sector_t first, last;
+	size_t cnt;
+
+	if (offset >= inode->data.length) {
+		return;
+	}
+	first = byte_to_sector(inode, offset);
+	last = length && length < inode->data.length - offset
+			   ? byte_to_sector(inode, offset + length - 1)
+			   : byte_to_sector(inode, inode->data.length - 1);
+	cnt = last - first + 1;
+	if (advice == FADV_WILLNEED) {
+		inode_ra_fill(inode, first, cnt);
+		return;
+	}
+	lock_acquire(&inode->inoode_lock);
+	if (advice == FADV_DONTNEED) {
+		if (inode->ra_cnt && inode->ra_start <= last &&
+			first < inode->ra_start + inode->ra_cnt) {
+			inode->ra_cnt = 0;
+		}
+	} else {
+		inode->advice = advice;
+		inode->advice_ofs = offset;
+		inode->advice_len = length;
+		if (advice != FADV_SEQUENTIAL) {
+			inode->ra_cnt = 0;
+		}
+	}
+	lock_release(&inode->inoode_lock);
+}
+
+/* Returns advice of how INODE is read at byte POS, one of FADV_NORMAL,
+ * FADV_RANDOM and FADV_SEQUENTIAL. */
+int inode_get_advice(const struct inode *inode, off_t pos) {
+	return inode_advice_at(inode, pos);
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t inode_length(const struct inode *inode) { return inode->data.length; }
@@ -19,5 +19,7 @@ off_t inode_write_at(struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(const struct inode *);
+void inode_advise(struct inode *, off_t offset, off_t length, int advice);
+int inode_get_advice(const struct inode *, off_t pos);
 
 #endif /* filesys/inode.h */
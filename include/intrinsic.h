@@ -128,6 +128,41 @@ __attribute__((always_inline)) static __inline uint64_t rcr2(void) {
 	return val;
 }
 
+__attribute__((always_inline)) static __inline uint64_t rcr4(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr4,%0"
+					 : "=r"(val));
+	return val;
+}
+
+__attribute__((always_inline)) static __inline void lcr4(uint64_t val) {
+	__asm __volatile("movq %0, %%cr4"
+					 :
+					 : "r"(val));
+}
+
+/* Query CPUID leaf LEAF, subleaf SUBLEAF. */
+__attribute__((always_inline)) static __inline void
+cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+	  uint32_t *ecx, uint32_t *edx) {
+	__asm __volatile("cpuid"
+					 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+					 : "a"(leaf), "c"(subleaf));
+}
+
+/* Invalidate TLB entry of ADDR tagged with PCID. */
+__attribute__((always_inline)) static __inline void invpcid(uint64_t pcid,
+															uint64_t addr) {
+	struct {
+		uint64_t pcid;
+		uint64_t addr;
+	} desc = {pcid, addr};
+	__asm __volatile("invpcid %0, %1"
+					 :
+					 : "m"(desc), "r"((uint64_t)0)
+					 : "memory");
+}
+
 __attribute__((always_inline)) static __inline void write_msr(uint32_t ecx,
 															  uint64_t val) {
 	uint32_t edx, eax;
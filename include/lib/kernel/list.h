@@ -161,5 +161,6 @@ struct list_elem *list_min(struct list *, list_less_func *, void *aux);
 void circular_init(struct list_elem *elem);
 bool circular_is_alone(struct list_elem *elem);
 void circular_make(struct list *list);
+void circular_splice(struct list *list, struct list_elem *elem);
 
 #endif /* lib/kernel/list.h */
@@ -1,6 +1,8 @@
 #ifndef __LIB_SYSCALL_NR_H
 #define __LIB_SYSCALL_NR_H
 
+#include <stdint.h>
+
 /* System call numbers. */
 enum {
 	/* Projects 2 and later. */
@@ -36,6 +38,64 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Access pattern hints */
+	SYS_MADVISE, /* Advise how a memory range will be used. */
+	SYS_FADVISE, /* Advise how a file will be read. */
+
+	SYS_RSSLIMIT,	 /* Limit resident pages of this process. */
+	SYS_OOMADJ,		 /* Adjust OOM score of this process. */
+	SYS_MEMPRESSURE, /* Percent of swap space in use. */
+	SYS_FAULTSTAT,	 /* Page fault latency statistics. */
+};
+
+/* Range of SYS_OOMADJ, added to OOM score of 0 to 1000. */
+#define OOM_ADJ_MIN -1000 /* Never killed by OOM killer. */
+#define OOM_ADJ_MAX 1000  /* Killed first. */
+
+/* Fault types of SYS_FAULTSTAT. */
+enum fault_type {
+	FAULT_UNINIT, /* First touch of lazily loaded page. */
+	FAULT_ANON,   /* Anonymous page swapped in. */
+	FAULT_FILE,   /* File backed page read in. */
+	FAULT_COW,	/* Write on write protected page. */
+	FAULT_STACK,  /* Stack growth. */
+	FAULT_AROUND, /* Pages claimed around sequential fault. */
+	FAULT_TYPE_CNT
 };
 
+/* Histogram bucket N of SYS_FAULTSTAT counts faults that spent less than
+ * 2^(N + 1 + FAULT_HIST_SHIFT) cycles, last bucket counts the rest. */
+#define FAULT_HIST_CNT 16
+#define FAULT_HIST_SHIFT 10
+
+/* Latency of one fault type, in TSC cycles. */
+struct fault_stat {
+	uint64_t cnt;
+	uint64_t cycles;	   /* Whole fault */
+	uint64_t frame_cycles; /* Getting frame, including eviction */
+	uint64_t io_cycles;	/* Reading page content */
+	uint64_t frame_hist[FAULT_HIST_CNT];
+	uint64_t io_hist[FAULT_HIST_CNT];
+};
+
+/* Flags for SYS_MMAP. */
+#define MAP_ANONYMOUS 0x1 /* Zero filled memory, no file. */
+#define MAP_SHARED 0x2	/* Anonymous memory shared with forked children. */
+#define MAP_POPULATE 0x4  /* Fault in every page at mmap. */
+
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL 0	 /* No special treatment. */
+#define MADV_RANDOM 1	 /* Expect random access, no fault-around or readahead. */
+#define MADV_SEQUENTIAL 2 /* Expect sequential access, used once. */
+#define MADV_WILLNEED 3   /* Will be accessed soon, prefault first pages. */
+#define MADV_DONTNEED 4   /* Not needed anymore, release memory. */
+
+/* Advice for SYS_FADVISE, same meaning for the file content. */
+#define FADV_NORMAL MADV_NORMAL
+#define FADV_RANDOM MADV_RANDOM
+#define FADV_SEQUENTIAL MADV_SEQUENTIAL
+#define FADV_WILLNEED MADV_WILLNEED
+#define FADV_DONTNEED MADV_DONTNEED
+
 #endif /* lib/syscall-nr.h */
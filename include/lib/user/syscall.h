@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -40,7 +41,15 @@ int dup2(int oldfd, int newfd);
 
 /* Project 3 and optionally project 4. */
 void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void *mmap_flags(void *addr, size_t length, int writable, int fd,
+				 off_t offset, int flags);
 void munmap(void *addr);
+int madvise(void *addr, size_t length, int advice);
+int fadvise(int fd, off_t offset, off_t length, int advice);
+size_t rsslimit(size_t pages);
+int oomadj(int adj);
+int mempressure(void);
+int faultstat(struct fault_stat stats[FAULT_TYPE_CNT], bool reset);
 
 /* Project 4 only. */
 bool chdir(const char *dir);
@@ -7,20 +7,29 @@
 
 typedef bool pte_for_each_func(uint64_t *pte, void *va, void *aux);
 
+/* Number of 2 MB mappings split into 4 KB mappings. */
+extern uint64_t huge_split_cnt;
+/* Use process context identifiers when the CPU supports them. */
+extern bool pcid_allowed;
+
 uint64_t *pml4e_walk(uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create(void);
 bool pml4_for_each(uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy(uint64_t *pml4);
 void pml4_activate(uint64_t *pml4);
+void pml4_pcid_init(void);
+void mmu_print_stats(void);
 void *pml4_get_page(uint64_t *pml4, const void *upage);
 bool pml4_set_page(uint64_t *pml4, void *upage, void *kpage, bool rw);
-void pml4_clear_page(uint64_t *pml4, void *upage);
+bool pml4_set_huge_page(uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_split_page(uint64_t *pml4, const void *upage);
+bool pml4_clear_page(uint64_t *pml4, void *upage);
 bool pml4_is_dirty(uint64_t *pml4, const void *upage);
 void pml4_set_dirty(uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed(uint64_t *pml4, const void *upage);
 void pml4_set_accessed(uint64_t *pml4, const void *upage, bool accessed);
 bool pml4_is_writable(uint64_t *pml4, const void *upage);
-void pml4_set_writable(uint64_t *pml4, const void *upage, bool writable);
+bool pml4_set_writable(uint64_t *pml4, const void *upage, bool writable);
 
 #define is_writable(pte) (*(pte)&PTE_W)
 #define is_user_pte(pte) (*(pte)&PTE_U)
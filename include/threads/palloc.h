@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -13,11 +14,21 @@ enum palloc_flags {
 
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
+/* Let kernel and user pools lend free pages to each other. */
+extern bool pool_balance;
 
 uint64_t palloc_init(void);
 void *palloc_get_page(enum palloc_flags);
 void *palloc_get_multiple(enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned(enum palloc_flags, size_t page_cnt, size_t align_cnt);
+bool palloc_get_page_at(void *page);
+bool palloc_page_is_free(void *page);
 void palloc_free_page(void *);
 void palloc_free_multiple(void *, size_t page_cnt);
+void palloc_count_begin(void);
+size_t palloc_count_end(void);
+size_t palloc_kernel_shortage(void);
+size_t palloc_reserve_shortage(void);
+void palloc_print_stats(void);
 
 #endif /* threads/palloc.h */
@@ -41,5 +41,11 @@
 #define PTE_U 0x4							/* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20							/* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40							/* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80							/* 1=2 MB page (PDEs only). */
+
+/* 2 MB page mapped by a page directory entry. */
+#define HPGSIZE (1UL << PDXSHIFT)
+#define HPGCNT (HPGSIZE / PGSIZE)
+#define hpg_round_down(va) ((void *)((uint64_t)(va) & ~(HPGSIZE - 1)))
 
 #endif /* threads/pte.h */
@@ -115,6 +115,10 @@ struct thread {
 	/* List for locked by this thread.
 	 * Use this list to calculate real priority. */
 	struct list locking_list;
+	/* Exit before returning to user mode, set by thread_kill(). */
+	bool killed;
+	/* Semaphore slept on in sema_down_killable(), woken by thread_kill(). */
+	struct semaphore *killable_sema;
 
 	/* Shared between thread.c and synch.c. */
 	struct list_elem status_elem; /* Status list element. */
@@ -178,6 +182,7 @@ void do_iret(struct intr_frame *tf);
 
 // For sleep machanism
 void thread_sleep(int64_t);
+void thread_kill(struct thread *);
 bool sort_by_tick_ascending(const struct list_elem *, const struct list_elem *,
 							void *);
 void thread_wakeup(int64_t);
@@ -190,6 +195,9 @@ void thread_donate_priority_to_holder(struct thread *);
 int thread_max_priority_in_waiters(struct list *);
 void thread_reset_real_priority(void);
 
+typedef void thread_action_func(struct thread *t, void *aux);
+void thread_foreach(thread_action_func *, void *);
+
 // For 4BSD Scheduler
 void mlfqs_calculate_all_priority(void);
 void mlfqs_calculate_load_avg_and_recent_cpu(void);
@@ -6,9 +6,27 @@ enum vm_type;
 
 struct anon_page {
 	disk_sector_t sec_no;
+	/* Executable content of the page, NULL if none or page was modified.
+	 * Page with origin and without swap slot is reloaded from it. */
+	struct vm_file_arg *origin;
 };
 
+/* Swap devices as comma separated CHAN:DEV list, NULL for 1:1 only. */
+extern char *swap_devices;
+
+/* Read-only page of executable, shared through text cache */
+#define anon_is_text(page) ((page)->anon.origin && !(page)->writable)
+
 void vm_anon_init(void);
 bool anon_initializer(struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_shared(struct list *page_list);
+bool anon_writeback(struct page *page);
+void anon_share_in(struct page *page, void *kva);
+void anon_share_swap(struct page *dst, struct page *src);
+void anon_check_dirty(struct page *page);
+bool anon_in_origin(struct page *page);
+bool anon_needs_slot(struct list *page_list);
+size_t anon_swap_usage(size_t *total);
+void anon_print_stats(void);
 
 #endif
@@ -18,7 +18,7 @@ struct mmap_table {
 
 struct mmap {
 	void *va;
-	struct file *file;
+	struct file *file; /* NULL for anonymous mapping */
 	uint32_t page_count;
 	struct hash_elem mt_elem;
 };
@@ -26,11 +26,12 @@ struct mmap {
 void vm_file_init(void);
 bool file_backed_initializer(struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable, struct file *file,
-			  off_t offset);
+			  off_t offset, int flags);
 void do_munmap(void *va);
 
 void mmap_table_init(struct mmap_table *mt);
 void mmap_table_kill(struct mmap_table *mt);
+bool mmap_table_copy(struct mmap_table *dst, struct mmap_table *src);
 struct mmap *mt_find_mmap(struct mmap_table *mt, void *va);
 bool mt_insert_mmap(struct mmap_table *mt, struct mmap *page);
 void mt_remove_mmap(struct mmap_table *mt, struct mmap *page);
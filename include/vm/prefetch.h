@@ -0,0 +1,18 @@
+#ifndef VM_PREFETCH_H
+#define VM_PREFETCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Pages recorded in fault trace of one executable. */
+#define PREFETCH_TRACE_LEN 64
+
+/* Replay recorded faults of executable on exec. */
+extern bool prefetch_enabled;
+
+void prefetch_init(void);
+size_t prefetch_lookup(disk_sector_t inumber, void **va);
+void prefetch_store(disk_sector_t inumber, void **va, size_t cnt);
+void prefetch_print_stats(void);
+
+#endif /* vm/prefetch.h */
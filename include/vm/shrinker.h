@@ -0,0 +1,29 @@
+#ifndef VM_SHRINKER_H
+#define VM_SHRINKER_H
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cache giving its kernel memory back under pressure.
+ * COUNT returns pages the cache could free. SCAN frees objects worth up to
+ * NR_PAGES pages. SCAN is called by the reclaim path and the balancer
+ * thread, never from inside palloc or malloc. It may sleep, but should
+ * skip rather than wait for its own lock, as the caller may be faulting
+ * with it held. */
+struct shrinker {
+	const char *name;
+	size_t (*count)(void);
+	void (*scan)(size_t nr_pages);
+
+	/* Owned by shrinker.c */
+	uint64_t deferred; /* Pressure not large enough to scan a page yet */
+	uint64_t scan_cnt;
+	uint64_t freed_cnt; /* Pages returned to the kernel pool */
+	struct list_elem elem;
+};
+
+void shrinker_register(struct shrinker *shrinker);
+size_t shrink_caches(size_t scanned, size_t total);
+void shrinker_print_stats(void);
+
+#endif /* vm/shrinker.h */
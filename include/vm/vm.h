@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include "threads/palloc.h"
 #include <hash.h>
+#include <syscall-nr.h>
 
 typedef size_t clock_t;
 
@@ -27,7 +28,8 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
-/* Argument for when swap in page from file*/
+/* Argument for when swap in page from file.
+ * For anonymous page, FILE is a reference owned by this argument. */
 struct vm_file_arg {
 	struct file *file;
 	int32_t ofs;
@@ -37,6 +39,22 @@ struct vm_file_arg {
 
 extern void *user_start_page;
 extern size_t user_page_no;
+/* Frames of user allocation, user pool and kernel pool below it which
+ * may lend pages to user allocation */
+extern void *frame_start_page;
+extern size_t frame_page_no;
+/* Run same-page merging thread. */
+extern bool ksm_enabled;
+/* Map aligned 2 MB of untouched anonymous pages with a huge page. */
+extern bool huge_enabled;
+/* Run writeback thread cleaning dirty anonymous frames before eviction. */
+extern bool swapd_enabled;
+/* Run working set sampler, and keep working sets on reclaim. */
+extern bool ws_enabled;
+/* Run compaction thread keeping a free run for huge page. */
+extern bool compact_enabled;
+/* Resident page limit of initial process, 0 if unlimited. */
+extern size_t rss_limit_default;
 
 #include "devices/disk.h"
 #include "vm/uninit.h"
@@ -49,6 +67,7 @@ extern size_t user_page_no;
 
 struct page_operations;
 struct thread;
+struct inode;
 
 #define VM_TYPE(type) ((type)&7)
 #define SEC_WRITE_CNT (PGSIZE / DISK_SECTOR_SIZE)
@@ -64,7 +83,23 @@ struct page {
 
 	bool writable;
 	bool is_sharing;
+	/* Anonymous page of MAP_SHARED mapping. Sharers write the same frame
+	 * instead of copy-on-write. */
+	bool is_shmem;
 	uint64_t *pml4;
+	/* Process owning this page, charged for memory usage */
+	struct supplemental_page_table *spt;
+	/* Eviction clock value when this page was last evicted, 0 if never.
+	 * Used to measure refault distance. */
+	uint64_t evict_stamp;
+	/* Access pattern given by madvise, MADV_NORMAL, MADV_RANDOM or
+	 * MADV_SEQUENTIAL. */
+	uint8_t advice;
+	/* Working set sample when this page was last accessed, 0 if never.
+	 * ACCESSED keeps accessed bit cleared by the sampler for LRU. Both are
+	 * protected by frame lock. */
+	uint32_t ws_stamp;
+	bool accessed;
 
 	struct hash_elem spt_elem;
 	struct list_elem page_elem;
@@ -81,14 +116,38 @@ struct page {
 	};
 };
 
-#define vm_writable(page) (((page)->writable) && !((page)->is_sharing))
+#define vm_writable(page) \
+	(((page)->writable) && (!((page)->is_sharing) || ((page)->is_shmem)))
 #define vm_on_phymem(page) (((page)->kva) != NULL)
 
-/* The representation of "frame" */
+/* LRU lists that a frame can be on. */
+enum frame_lru {
+	LRU_NONE,	  /* Free or being claimed */
+	LRU_INACTIVE, /* Candidate for eviction */
+	LRU_ACTIVE,	/* Working set */
+};
+
+/* The representation of "frame".
+ * One descriptor per user frame is kept in the kernel pool, so it is packed
+ * in 64 bytes. */
 struct frame {
 	struct list page_list;
-	struct lock frame_lock;
-	bool is_claiming;
+
+	/* Owned by vm.c, protected by ft_lock. */
+	struct list_elem lru_elem;
+	/* Key in text cache if frame holds executable text, NULL if frame is
+	 * not in text cache. Protected by ft_lock. */
+	struct text_entry *text;
+
+	/* Flags share one word, and are written with interrupts off so that
+	 * writers under different locks do not lose each other's write. See
+	 * frame_set() in vm.c. */
+	bool is_locked : 1;   /* Frame lock, see frame_lock() in vm.c */
+	bool is_claiming : 1; /* Protected by frame lock */
+	/* Protected by ft_lock. */
+	enum frame_lru lru : 2;
+	bool is_file : 1;	/* Frame holds file backed page */
+	bool referenced : 1; /* Accessed once while on inactive list */
 };
 
 /* The function table for page operations.
@@ -108,11 +167,42 @@ struct page_operations {
 	if ((page)->operations->destroy) \
 	(page)->operations->destroy(page)
 
+/* Time spent by a page fault, in TSC cycles. */
+struct fault_clock {
+	uint64_t start;
+	uint64_t frame; /* In vm_get_frame, including eviction */
+	uint64_t io;	/* In swap_in */
+};
+
 /* Representation of current process's memory space.
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
 	struct hash spt_hash;
+
+	/* Memory accounting, protected by acct_lock in vm.c */
+	size_t rss;				/* Pages on frame, except zero page */
+	size_t rss_peak;		/* Largest RSS so far */
+	size_t swap_cnt;		/* Pages on swap slot */
+	size_t rss_limit;		/* Reclaim own pages above it, 0 if unlimited */
+	uint64_t limit_hit_cnt; /* # of faults at RSS limit */
+	int oom_adj;			/* Added to OOM score, OOM_ADJ_MIN never killed */
+	bool oom_killed;		/* Chosen by OOM killer, see thread_kill() */
+
+	/* Working set estimate by sampler, in resident pages */
+	size_t ws_size;
+	size_t ws_peak;
+	size_t ws_scan; /* Counted by the sampler pass in progress */
+
+	/* Fault being handled by owner thread, NULL if none */
+	struct fault_clock *fault_clock;
+
+	/* Executable pages faulted since exec, NULL if not recording */
+	void **trace_va;
+	size_t trace_cnt;
+	disk_sector_t trace_inumber;
+	/* Executable read at once by exec prefetch, NULL if none */
+	struct prefetch_batch *prefetch_batch;
 };
 
 #include "threads/thread.h"
@@ -125,8 +215,10 @@ bool spt_insert_page(struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page(struct supplemental_page_table *spt, struct page *page);
 
 void spt_destroy(struct supplemental_page_table *spt);
+void spt_print_acct(struct supplemental_page_table *spt, const char *name);
 
 void vm_init(void);
+void vm_print_stats(void);
 bool vm_try_handle_fault(struct intr_frame *f, void *addr, bool user,
 						 bool write, bool not_present);
 
@@ -136,7 +228,18 @@ bool vm_alloc_page_with_initializer(enum vm_type type, void *upage,
 									bool writable, vm_initializer *init,
 									void *aux);
 void vm_dealloc_page(struct page *page);
+bool vm_alloc_origin_page(void *upage, bool writable,
+						  struct vm_file_arg *origin);
 bool vm_claim_page(void *va);
+int do_madvise(void *addr, size_t length, int advice);
+size_t vm_set_rss_limit(size_t limit);
+int vm_set_oom_adj(int adj);
+int vm_mem_pressure(void);
+int vm_get_fault_stat(struct fault_stat *stats, bool reset);
+void vm_exec_prefetch(struct file *file);
+bool vm_prefetch_copy(const struct vm_file_arg *origin, void *kva);
+void vm_balance_wake(void);
+void vm_acct_swap(struct page *page, int delta);
 enum vm_type page_get_type(struct page *page);
 
 #endif /* VM_VM_H */
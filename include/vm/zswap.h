@@ -0,0 +1,21 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Maximum share of user memory, in percent, used by compressed pool.
+ * 0 disables zswap, which is the default. */
+extern size_t zswap_max_percent;
+/* Share used by -zswap without a value */
+#define ZSWAP_PERCENT_DEFAULT 20
+
+typedef void zswap_writeback_func(disk_sector_t sec_no, const void *buffer);
+
+void zswap_init(zswap_writeback_func *writeback);
+bool zswap_store(disk_sector_t sec_no, const void *kva);
+bool zswap_load(disk_sector_t sec_no, void *kva);
+void zswap_invalidate(disk_sector_t sec_no);
+void zswap_print_stats(void);
+
+#endif /* vm/zswap.h */
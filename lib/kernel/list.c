@@ -475,4 +475,15 @@ void circular_make(struct list *list) {
 	// link head and tail and make circular list
 	list_head(list)->next = list_tail(list);
 	list_tail(list)->prev = list_head(list);
-}
\ No newline at end of file
+}
+
+/* Insert circular list that ELEM belongs to at the end of LIST.
+   Reverse of circular_make. */
+void circular_splice(struct list *list, struct list_elem *elem) {
+	struct list_elem *last = elem->prev;
+
+	last->next = list_tail(list);
+	elem->prev = list_tail(list)->prev;
+	list_tail(list)->prev->next = elem;
+	list_tail(list)->prev = last;
+}
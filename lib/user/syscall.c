@@ -48,12 +48,17 @@ syscall(uint64_t num_, uint64_t a1_, uint64_t a2_, uint64_t a3_, uint64_t a4_,
 			 ((uint64_t)ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                       \
-	(syscall(((uint64_t *)NUMBER), ((uint64_t)ARG0), ((uint64_t)ARG1), \
+	(syscall(((uint64_t)NUMBER), ((uint64_t)ARG0), ((uint64_t)ARG1),   \
 			 ((uint64_t)ARG2), ((uint64_t)ARG3), 0, 0))
 
 #define syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)               \
 	(syscall(((uint64_t)NUMBER), ((uint64_t)ARG0), ((uint64_t)ARG1), \
 			 ((uint64_t)ARG2), ((uint64_t)ARG3), ((uint64_t)ARG4), 0))
+
+#define syscall6(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4, ARG5)         \
+	(syscall(((uint64_t)NUMBER), ((uint64_t)ARG0), ((uint64_t)ARG1), \
+			 ((uint64_t)ARG2), ((uint64_t)ARG3), ((uint64_t)ARG4),   \
+			 ((uint64_t)ARG5)))
 void halt(void) {
 	syscall0(SYS_HALT);
 	NOT_REACHED();
@@ -102,8 +107,32 @@ void *mmap(void *addr, size_t length, int writable, int fd, off_t offset) {
 	return (void *)syscall5(SYS_MMAP, addr, length, writable, fd, offset);
 }
 
+void *mmap_flags(void *addr, size_t length, int writable, int fd,
+				 off_t offset, int flags) {
+	return (void *)syscall6(SYS_MMAP, addr, length, writable, fd, offset,
+							flags);
+}
+
 void munmap(void *addr) { syscall1(SYS_MUNMAP, addr); }
 
+int madvise(void *addr, size_t length, int advice) {
+	return syscall3(SYS_MADVISE, addr, length, advice);
+}
+
+int fadvise(int fd, off_t offset, off_t length, int advice) {
+	return syscall4(SYS_FADVISE, fd, offset, length, advice);
+}
+
+size_t rsslimit(size_t pages) { return syscall1(SYS_RSSLIMIT, pages); }
+
+int oomadj(int adj) { return syscall1(SYS_OOMADJ, adj); }
+
+int mempressure(void) { return syscall0(SYS_MEMPRESSURE); }
+
+int faultstat(struct fault_stat stats[FAULT_TYPE_CNT], bool reset) {
+	return syscall2(SYS_FAULTSTAT, stats, reset);
+}
+
 bool chdir(const char *dir) { return syscall1(SYS_CHDIR, dir); }
 
 bool mkdir(const char *dir) { return syscall1(SYS_MKDIR, dir); }
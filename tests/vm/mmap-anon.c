@@ -0,0 +1,41 @@
+/* Maps anonymous memory, lazily and with MAP_POPULATE, and verifies that
+   it is zero filled, keeps what is written and is inaccessible after
+   unmapped. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LAZY ((char *)0x10000000)
+#define POPULATED ((char *)0x20000000)
+#define PAGE_SIZE 4096
+#define SIZE (16 * PAGE_SIZE)
+
+static void check_anon(char *map, const char *name) {
+	size_t i;
+
+	for (i = 0; i < SIZE; i++)
+		if (map[i] != 0)
+			fail("%s memory is not zero at %zu", name, i);
+	for (i = 0; i < SIZE; i += PAGE_SIZE)
+		map[i] = (char)(i / PAGE_SIZE + 1);
+	for (i = 0; i < SIZE; i += PAGE_SIZE)
+		if (map[i] != (char)(i / PAGE_SIZE + 1))
+			fail("%s memory is inconsistent at page %zu", name, i / PAGE_SIZE);
+	msg("%s memory is zero filled and writable", name);
+}
+
+void test_main(void) {
+	CHECK(mmap_flags(LAZY, SIZE, 1, -1, 0, MAP_ANONYMOUS) == LAZY,
+		  "mmap anonymous");
+	check_anon(LAZY, "lazy");
+	CHECK(mmap_flags(POPULATED, SIZE, 1, -1, 0,
+					 MAP_ANONYMOUS | MAP_POPULATE) == POPULATED,
+		  "mmap anonymous populated");
+	check_anon(POPULATED, "populated");
+
+	munmap(POPULATED);
+	munmap(LAZY);
+
+	fail("unmapped memory is readable (%d)", *LAZY);
+}
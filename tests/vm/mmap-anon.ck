@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-anon) begin
+(mmap-anon) mmap anonymous
+(mmap-anon) lazy memory is zero filled and writable
+(mmap-anon) mmap anonymous populated
+(mmap-anon) populated memory is zero filled and writable
+mmap-anon: exit(-1)
+EOF
+pass;
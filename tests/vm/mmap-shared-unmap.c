@@ -0,0 +1,28 @@
+/* Forked child unmaps shared anonymous memory. Verifies that the child
+   can not access it anymore, while the parent still can. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SHARED ((int *)0x10000000)
+
+void test_main(void) {
+	pid_t child;
+
+	CHECK(mmap_flags(SHARED, 4096, 1, -1, 0, MAP_ANONYMOUS | MAP_SHARED) ==
+			  SHARED,
+		  "mmap shared");
+	*SHARED = 1;
+
+	child = fork("child");
+	if (child == 0) {
+		*SHARED = 2;
+		munmap(SHARED);
+		exit(*SHARED);
+	}
+	CHECK(wait(child) == -1, "child is killed reading unmapped memory");
+	CHECK(*SHARED == 2, "shared memory is kept for parent");
+	*SHARED = 3;
+	munmap(SHARED);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shared-unmap) begin
+(mmap-shared-unmap) mmap shared
+(mmap-shared-unmap) child is killed reading unmapped memory
+(mmap-shared-unmap) shared memory is kept for parent
+(mmap-shared-unmap) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Maps shared and private anonymous memory, and verifies that what a
+   forked child writes is seen by its parent only on shared memory. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SHARED ((int *)0x10000000)
+#define PRIVATE ((int *)0x20000000)
+
+void test_main(void) {
+	pid_t child;
+
+	CHECK(mmap_flags(SHARED, 4096, 1, -1, 0, MAP_ANONYMOUS | MAP_SHARED) ==
+			  SHARED,
+		  "mmap shared");
+	CHECK(mmap_flags(PRIVATE, 4096, 1, -1, 0, MAP_ANONYMOUS) == PRIVATE,
+		  "mmap private");
+	*SHARED = 1;
+	*PRIVATE = 1;
+
+	child = fork("child");
+	if (child == 0) {
+		*SHARED = 2;
+		*PRIVATE = 2;
+		exit(0);
+	}
+	CHECK(wait(child) == 0, "wait for child");
+	CHECK(*SHARED == 2, "shared memory is written by child");
+	CHECK(*PRIVATE == 1, "private memory is kept from child");
+}
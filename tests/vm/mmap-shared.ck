@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shared) begin
+(mmap-shared) mmap shared
+(mmap-shared) mmap private
+(mmap-shared) wait for child
+(mmap-shared) shared memory is written by child
+(mmap-shared) private memory is kept from child
+(mmap-shared) end
+EOF
+pass;
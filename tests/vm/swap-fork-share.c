@@ -0,0 +1,53 @@
+/* Forks after anonymous pages are swapped out, so that the parent and the
+ * child share their swap slots. Then both of them read every page at the
+ * same time, faulting the same slots in from both processes.
+ * For this test, Pintos memory size is 10MB. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (8 * ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Return true if every page holds what is written by test_main */
+static bool check_pages(void) {
+	size_t i;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		if ((char)(i * 7) != big_chunks[i * PAGE_SIZE]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void test_main(void) {
+	size_t i;
+	pid_t child;
+
+	msg("write over %d pages", PAGE_COUNT);
+	for (i = 0; i < PAGE_COUNT; i++) {
+		big_chunks[i * PAGE_SIZE] = (char)(i * 7);
+	}
+
+	msg("fork");
+	child = fork("child");
+	if (child == 0) {
+		exit(check_pages() ? 0 : 1);
+	}
+	CHECK(child > 0, "fork returned pid");
+	if (!check_pages()) {
+		fail("data of parent is inconsistent");
+	}
+	if (wait(child) != 0) {
+		fail("data of child is inconsistent");
+	}
+}
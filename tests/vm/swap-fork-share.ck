@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-fork-share) begin
+(swap-fork-share) write over 2048 pages
+(swap-fork-share) fork
+(swap-fork-share) fork returned pid
+(swap-fork-share) end
+EOF
+pass;
@@ -31,6 +31,8 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/zswap.h"
+#include "vm/prefetch.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -162,6 +164,7 @@ static void paging_init(uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_pcid_init();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -216,11 +219,35 @@ static char **parse_options(char **argv) {
 			random_init(atoi(value));
 		else if (!strcmp(name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp(name, "-nopcid"))
+			pcid_allowed = false;
 #ifdef USERPROG
 		else if (!strcmp(name, "-ul"))
 			user_page_limit = atoi(value);
 		else if (!strcmp(name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp(name, "-zswap"))
+			zswap_max_percent = value ? atoi(value) : ZSWAP_PERCENT_DEFAULT;
+		else if (!strcmp(name, "-ksm"))
+			ksm_enabled = true;
+		else if (!strcmp(name, "-huge"))
+			huge_enabled = true;
+		else if (!strcmp(name, "-swapd"))
+			swapd_enabled = true;
+		else if (!strcmp(name, "-wss"))
+			ws_enabled = true;
+		else if (!strcmp(name, "-prefetch"))
+			prefetch_enabled = true;
+		else if (!strcmp(name, "-compact"))
+			compact_enabled = true;
+		else if (!strcmp(name, "-balance"))
+			pool_balance = true;
+		else if (!strcmp(name, "-rsslimit"))
+			rss_limit_default = atoi(value);
+		else if (!strcmp(name, "-swap"))
+			swap_devices = value;
 #endif
 		else
 			PANIC("unknown option `%s' (use -h for help)", name);
@@ -318,8 +345,24 @@ static void usage(void) {
 		   "  -f                 Format file system disk during startup.\n"
 		   "  -rs=SEED           Set random number seed to SEED.\n"
 		   "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+		   "  -nopcid            Flush whole TLB on every address space switch.\n"
 #ifdef USERPROG
 		   "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+		   "  -zswap[=PCT]       Use up to PCT%% of user memory for compressed\n"
+		   "                     swap cache (default 20).\n"
+		   "  -ksm               Merge identical anonymous pages in background.\n"
+		   "  -huge              Map aligned 2 MB anonymous regions with huge pages.\n"
+		   "  -swapd             Write dirty anonymous pages to swap in background.\n"
+		   "  -wss               Sample working set of each process, keep it on reclaim.\n"
+		   "  -prefetch          Record page faults of executables, prefetch on exec.\n"
+		   "  -compact           Compact user memory in background for huge pages.\n"
+		   "  -balance           Lend free pages between kernel and user pools.\n"
+		   "  -rsslimit=COUNT    Limit resident pages of each process to COUNT,\n"
+		   "                     reclaiming its own pages first (default none).\n"
+		   "  -swap=DISKS        Swap on comma separated CHAN:DEV disks\n"
+		   "                     (default 1:1).\n"
 #endif
 	);
 	power_off();
@@ -344,6 +387,8 @@ void power_off(void) {
 static void print_stats(void) {
 	timer_print_stats();
 	thread_print_stats();
+	palloc_print_stats();
+	mmu_print_stats();
 #ifdef FILESYS
 	disk_print_stats();
 #endif
@@ -352,4 +397,7 @@ static void print_stats(void) {
 #ifdef USERPROG
 	exception_print_stats();
 #endif
+#ifdef VM
+	vm_print_stats();
+#endif
 }
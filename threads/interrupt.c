@@ -13,6 +13,7 @@
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #endif
 
 /* Number of x86_64 interrupts. */
@@ -354,6 +355,13 @@ void intr_handler(struct intr_frame *frame) {
 		if (yield_on_return)
 			thread_yield();
 	}
+#ifdef USERPROG
+	/* Killed thread exits instead of returning to user mode */
+	if (frame->cs == SEL_UCSEG && thread_current()->killed) {
+		intr_enable();
+		exit_with_exit_status(-1);
+	}
+#endif
 }
 
 /* Dumps interrupt frame F to the console, for debugging. */
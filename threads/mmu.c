@@ -6,11 +6,156 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "threads/interrupt.h"
+#include <stdio.h>
 #include "intrinsic.h"
 
+uint64_t huge_split_cnt;
+
+/* Process context identifiers.
+ * With PCID, TLB entries are tagged with the PCID loaded in CR3, so loading
+ * CR3 of another address space keeps entries of the others. Every pml4 gets
+ * one of PCID_CNT identifiers when activated, recycling the least recently
+ * activated one. PCID 0 is kept for base_pml4. */
+#define PCID_CNT 64
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PCIDE (1 << 17)
+#define CPUID_PCID (1 << 17)   /* CPUID.01H:ECX */
+#define CPUID_INVPCID (1 << 10) /* CPUID.07H:EBX */
+
+struct pcid_slot {
+	uint64_t *pml4; /* Address space owning this PCID, NULL if free. */
+	uint64_t stamp; /* Last activation, for recycling. */
+	bool stale;		/* TLB may hold entries changed since last use. */
+};
+
+/* Protected by disabling interrupts. */
+static struct pcid_slot pcid_slots[PCID_CNT];
+static uint64_t pcid_clock;
+static bool pcid_enabled;
+static bool invpcid_enabled;
+
+/* Use PCID if the CPU supports it. */
+bool pcid_allowed = true;
+
+/* Statistics. */
+static uint64_t cr3_load_cnt;	   /* # of CR3 loads. */
+static uint64_t tlb_flush_cnt;	   /* # of CR3 loads flushing TLB. */
+static uint64_t pcid_recycle_cnt;  /* # of PCIDs taken from other pml4. */
+static uint64_t tlb_invalidate_cnt; /* # of entries invalidated off CR3. */
+
+/* Enables PCID if the CPU supports it. CR3 should have PCID 0. */
+void pml4_pcid_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if (!pcid_allowed || !(ecx & CPUID_PCID))
+		return;
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+		invpcid_enabled = (ebx & CPUID_INVPCID) != 0;
+	}
+	lcr4(rcr4() | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns PCID of PML4, 0 if it has none.
+ * Interrupts should be off. */
+static unsigned pcid_find(uint64_t *pml4) {
+	for (unsigned pcid = 1; pcid < PCID_CNT; pcid++)
+		if (pcid_slots[pcid].pml4 == pml4)
+			return pcid;
+	return 0;
+}
+
+/* Returns CR3 value that activates PML4 with its PCID, assigning a PCID if
+ * it has none. TLB entries of the PCID survive unless it was recycled or
+ * went stale. Interrupts should be off. */
+static uint64_t pcid_cr3(uint64_t *pml4) {
+	unsigned pcid = 0, victim = 1;
+	bool flush = false;
+
+	if (pml4 != base_pml4) {
+		pcid = pcid_find(pml4);
+		if (pcid == 0) {
+			for (pcid = 1; pcid < PCID_CNT; pcid++) {
+				if (pcid_slots[pcid].pml4 == NULL)
+					break;
+				if (pcid_slots[pcid].stamp < pcid_slots[victim].stamp)
+					victim = pcid;
+			}
+			if (pcid == PCID_CNT) {
+				pcid = victim;
+				pcid_recycle_cnt++;
+			}
+			pcid_slots[pcid].pml4 = pml4;
+			flush = true;
+		}
+		flush |= pcid_slots[pcid].stale;
+		pcid_slots[pcid].stale = false;
+		pcid_slots[pcid].stamp = ++pcid_clock;
+	}
+	if (flush)
+		tlb_flush_cnt++;
+	return vtop(pml4) | pcid | (flush ? 0 : CR3_NOFLUSH);
+}
+
+/* Invalidates TLB entry of VA in PML4 after its page table entry changed.
+ * Without PCID, only the active address space can have TLB entries. */
+static void pml4_invalidate(uint64_t *pml4, uint64_t va) {
+	enum intr_level old_level = intr_disable();
+	unsigned pcid;
+
+	if (PTE_ADDR(rcr3()) == vtop(pml4))
+		invlpg(va);
+	else if (pcid_enabled && (pcid = pcid_find(pml4)) != 0) {
+		if (invpcid_enabled)
+			invpcid(pcid, va);
+		else
+			pcid_slots[pcid].stale = true;
+		tlb_invalidate_cnt++;
+	}
+	intr_set_level(old_level);
+}
+
+/* Prints TLB statistics. */
+void mmu_print_stats(void) {
+	printf("TLB: %llu CR3 loads, %llu full flushes, %llu PCID recycles, "
+		   "%llu remote invalidations%s\n",
+		   cr3_load_cnt, tlb_flush_cnt, pcid_recycle_cnt, tlb_invalidate_cnt,
+		   pcid_enabled ? "" : " (no PCID)");
+}
+
+/* Replaces 2 MB mapping in PDE with a page table of 4 KB mappings to the
+ * same frames, keeping permission. Accessed and dirty bits are kept only on
+ * the page of VA, others start clean as if just mapped.
+ * Returns false if memory allocation failed. */
+static bool pde_split(uint64_t *pde, const uint64_t va) {
+	uint64_t *pt = palloc_get_page(0);
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (PTE_ADDR(*pde) + i * PGSIZE) | (flags & ~(PTE_A | PTE_D));
+	pt[PTX(va)] |= flags & (PTE_A | PTE_D);
+	*pde = vtop(pt) | PTE_U | PTE_W | PTE_P;
+	huge_split_cnt++;
+	return true;
+}
+
+/* For 2 MB mapping, returns the page directory entry itself unless CREATE
+ * is set, in which case the mapping is split first. */
 static uint64_t *pgdir_walk(uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX(va);
 	if (pdp) {
+		if (pdp[idx] & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!pde_split(&pdp[idx], va))
+				return NULL;
+		}
 		uint64_t *pte = (uint64_t *)pdp[idx];
 		if (!((uint64_t)pte & PTE_P)) {
 			if (create) {
@@ -85,6 +230,39 @@ uint64_t *pml4e_walk(uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Splits 2 MB mapping covering user virtual page UPAGE in PML4 into 4 KB
+ * mappings, if there is one. Returns false if memory allocation failed,
+ * then the mapping is left as it was. */
+bool pml4_split_page(uint64_t *pml4, const void *upage) {
+	uint64_t *pte = pml4e_walk(pml4, (uint64_t)upage, 0);
+
+	if (pte == NULL || !(*pte & PTE_PS))
+		return true;
+	if (pml4e_walk(pml4, (uint64_t)upage, 1) == NULL)
+		return false;
+	/* Drop the 2 MB TLB entry, so accessed and dirty bits go to 4 KB ones */
+	pml4_invalidate(pml4, (uint64_t)upage);
+	return true;
+}
+
+/* Returns the address of page directory entry for VA in PML4, creating the
+ * upper level tables if needed. Returns NULL if memory allocation failed. */
+static uint64_t *pml4_pde_walk(uint64_t *pml4, const uint64_t va) {
+	uint64_t *table = pml4;
+	unsigned idx[2] = {PML4(va), PDPE(va)};
+
+	for (int level = 0; level < 2; level++) {
+		if (!(table[idx[level]] & PTE_P)) {
+			uint64_t *new_page = palloc_get_page(PAL_ZERO);
+			if (new_page == NULL)
+				return NULL;
+			table[idx[level]] = vtop(new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov(PTE_ADDR(table[idx[level]]));
+	}
+	return &table[PDX(va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -117,7 +295,14 @@ static bool pgdir_for_each(uint64_t *pdp, pte_for_each_func *func, void *aux,
 						   unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *)pdp[i]);
-		if (((uint64_t)pte) & PTE_P)
+		/* 2 MB mapping is visited once by its page directory entry */
+		if (pdp[i] & PTE_PS) {
+			void *va = (void *)(((uint64_t)pml4_index << PML4SHIFT) |
+								((uint64_t)pdp_index << PDPESHIFT) |
+								((uint64_t)i << PDXSHIFT));
+			if (!func(&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t)pte) & PTE_P)
 			if (!pt_for_each((uint64_t *)PTE_ADDR(pte), func, aux, pml4_index,
 							 pdp_index, i))
 				return false;
@@ -160,7 +345,8 @@ static void pt_destroy(uint64_t *pt) {
 static void pgdir_destroy(uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *)pdp[i]);
-		if (((uint64_t)pte) & PTE_P)
+		/* Frames of 2 MB mapping are not a page table */
+		if (((uint64_t)pte) & PTE_P && !(pdp[i] & PTE_PS))
 			pt_destroy(PTE_ADDR(pte));
 	}
 	palloc_free_page((void *)pdp);
@@ -181,6 +367,15 @@ void pml4_destroy(uint64_t *pml4) {
 		return;
 	ASSERT(pml4 != base_pml4);
 
+	/* PCID goes back to the pool, flushed when assigned again. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable();
+		unsigned pcid = pcid_find(pml4);
+		if (pcid != 0)
+			pcid_slots[pcid].pml4 = NULL;
+		intr_set_level(old_level);
+	}
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov((uint64_t *)pml4[0]);
 	if (((uint64_t)pdpe) & PTE_P)
@@ -190,7 +385,20 @@ void pml4_destroy(uint64_t *pml4) {
 
 /* Loads page directory PD into the CPU's page directory base
  * register. */
-void pml4_activate(uint64_t *pml4) { lcr3(vtop(pml4 ? pml4 : base_pml4)); }
+void pml4_activate(uint64_t *pml4) {
+	enum intr_level old_level = intr_disable();
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	cr3_load_cnt++;
+	if (pcid_enabled)
+		lcr3(pcid_cr3(pml4));
+	else {
+		tlb_flush_cnt++;
+		lcr3(vtop(pml4));
+	}
+	intr_set_level(old_level);
+}
 
 /* Looks up the physical address that corresponds to user virtual
  * address UADDR in pml4.  Returns the kernel virtual address
@@ -201,6 +409,8 @@ void *pml4_get_page(uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk(pml4, (uint64_t)uaddr, 0);
 
+	if (pte && (*pte & PTE_P) && (*pte & PTE_PS))
+		return ptov(PTE_ADDR(*pte)) + ((uint64_t)uaddr & (HPGSIZE - 1));
 	if (pte && (*pte & PTE_P))
 		return ptov(PTE_ADDR(*pte)) + pg_ofs(uaddr);
 	return NULL;
@@ -227,22 +437,54 @@ bool pml4_set_page(uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Maps 2 MB of user virtual address from UPAGE to physically contiguous
+ * frames from KPAGE with a single page directory entry. Both should be
+ * aligned to 2 MB and nothing in the range should be mapped.
+ * Returns false if memory allocation failed or something is mapped. */
+bool pml4_set_huge_page(uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT(((uint64_t)upage & (HPGSIZE - 1)) == 0);
+	ASSERT(((uint64_t)kpage & (HPGSIZE - 1)) == 0);
+	ASSERT(is_user_vaddr(upage));
+	ASSERT(pml4 != base_pml4);
+
+	uint64_t *pde = pml4_pde_walk(pml4, (uint64_t)upage);
+
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov(PTE_ADDR(*pde));
+		if (*pde & PTE_PS)
+			return false;
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page(pt);
+	}
+	*pde = vtop(kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	pml4_invalidate(pml4, (uint64_t)upage);
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
-void pml4_clear_page(uint64_t *pml4, void *upage) {
+ * UPAGE need not be mapped.
+ * Returns false if 2 MB mapping covering UPAGE could not be split, then
+ * UPAGE is still mapped. */
+bool pml4_clear_page(uint64_t *pml4, void *upage) {
 	uint64_t *pte;
 	ASSERT(pg_ofs(upage) == 0);
 	ASSERT(is_user_vaddr(upage));
 
-	pte = pml4e_walk(pml4, (uint64_t)upage, false);
+	if (!pml4_split_page(pml4, upage))
+		return false;
+	pte = pml4e_walk(pml4, (uint64_t)upage, 0);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3() == vtop(pml4))
-			invlpg((uint64_t)upage);
+		pml4_invalidate(pml4, (uint64_t)upage);
 	}
+	return true;
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -264,8 +506,7 @@ void pml4_set_dirty(uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t)PTE_D;
 
-		if (rcr3() == vtop(pml4))
-			invlpg((uint64_t)vpage);
+		pml4_invalidate(pml4, (uint64_t)vpage);
 	}
 }
 
@@ -288,8 +529,7 @@ void pml4_set_accessed(uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t)PTE_A;
 
-		if (rcr3() == vtop(pml4))
-			invlpg((uint64_t)vpage);
+		pml4_invalidate(pml4, (uint64_t)vpage);
 	}
 }
 
@@ -301,16 +541,23 @@ bool pml4_is_writable(uint64_t *pml4, const void *vpage) {
 }
 
 /* Set the writable bit to WRITABLE in the PTE for virtual page VPAGE
- * in PML4. */
-void pml4_set_writable(uint64_t *pml4, const void *vpage, bool writable) {
+ * in PML4. Returns false if 2 MB mapping covering VPAGE could not be
+ * split, then nothing is changed. */
+bool pml4_set_writable(uint64_t *pml4, const void *vpage, bool writable) {
 	uint64_t *pte = pml4e_walk(pml4, (uint64_t)vpage, false);
+	/* Only VPAGE changes, so 2 MB mapping is split */
+	if (pte && (*pte & PTE_PS) && !(*pte & PTE_W) != !writable) {
+		if (!pml4_split_page(pml4, vpage))
+			return false;
+		pte = pml4e_walk(pml4, (uint64_t)vpage, false);
+	}
 	if (pte) {
 		if (writable)
 			*pte |= PTE_W;
 		else
 			*pte &= ~(uint32_t)PTE_W;
 
-		if (rcr3() == vtop(pml4))
-			invlpg((uint64_t)vpage);
+		pml4_invalidate(pml4, (uint64_t)vpage);
 	}
+	return true;
 }
\ No newline at end of file
@@ -8,8 +8,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -34,6 +36,7 @@ struct pool {
 	struct lock lock;		 /* Mutual exclusion. */
 	struct bitmap *used_map; /* Bitmap of free pages. */
 	uint8_t *base;			 /* Base of pool. */
+	size_t free_cnt;		 /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -41,10 +44,27 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Let kernel and user pools lend free pages to each other. */
+bool pool_balance;
+/* Kernel pool lends pages to user allocation while more than
+   1/LEND_RATIO of it is free, and wants them back below half of it. */
+#define LEND_RATIO 4
+/* Free user pages kept for kernel allocation once kernel pool is
+   exhausted, until it recovers. */
+#define KERNEL_RESERVE 32
+static size_t kernel_reserve;
+static uint64_t lend_cnt, borrow_cnt;
+/* Kernel pages freed by thread FREE_COUNTER, see palloc_count_begin(). */
+static struct thread *free_counter;
+static size_t counted_free_cnt;
+
 static void init_pool(struct pool *p, void **bm_base, uint64_t start,
 					  uint64_t end);
 
 static bool page_from_pool(const struct pool *, void *page);
+static void *pool_get(struct pool *, size_t page_cnt, size_t keep_cnt);
+static void pool_count_free(struct pool *, long delta);
 
 /* multiboot info */
 struct multiboot_info {
@@ -236,6 +256,11 @@ static void populate_pools(struct area *base_mem, struct area *ext_mem) {
 			}
 		}
 	}
+	kernel_pool.free_cnt = bitmap_count(kernel_pool.used_map, 0,
+										bitmap_size(kernel_pool.used_map),
+										false);
+	user_pool.free_cnt = bitmap_count(user_pool.used_map, 0,
+									  bitmap_size(user_pool.used_map), false);
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -256,6 +281,10 @@ uint64_t palloc_init(void) {
 #ifdef VM
 	user_start_page = user_pool.base;
 	user_page_no = bitmap_size(user_pool.used_map);
+	/* Kernel pool below user pool may hold user frames too */
+	frame_start_page = pool_balance ? kernel_pool.base : user_pool.base;
+	frame_page_no =
+		pg_no(user_pool.base) - pg_no(frame_start_page) + user_page_no;
 #endif
 	return ext_mem.end;
 }
@@ -267,17 +296,66 @@ uint64_t palloc_init(void) {
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
+	size_t kernel_cnt = bitmap_size(kernel_pool.used_map);
+	void *pages;
+
+	if (flags & PAL_USER) {
+		pages = pool_get(&user_pool, page_cnt, kernel_reserve);
+		if (!pages && pool_balance) {
+			pages = pool_get(&kernel_pool, page_cnt, kernel_cnt / LEND_RATIO);
+			if (pages)
+				lend_cnt += page_cnt;
+		}
+	} else {
+		pages = pool_get(&kernel_pool, page_cnt, 0);
+		if (pages && kernel_pool.free_cnt >= KERNEL_RESERVE)
+			kernel_reserve = 0;
+		if (!pages && pool_balance) {
+			/* Borrow from user pool, and keep some of it for later */
+			kernel_reserve = KERNEL_RESERVE;
+			pages = pool_get(&user_pool, page_cnt, 0);
+			if (pages)
+				borrow_cnt += page_cnt;
+		}
+#ifdef VM
+		/* Let VM take back pages lent to user pool */
+		if (pool_balance &&
+			kernel_pool.free_cnt < kernel_cnt / LEND_RATIO / 2)
+			vm_balance_wake();
+#endif
+	}
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset(pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
+/* Obtains PAGE_CNT contiguous free pages like palloc_get_multiple,
+   whose address is aligned to ALIGN_CNT pages.  Returns a null
+   pointer if no such run of pages is free. */
+void *palloc_get_aligned(enum palloc_flags flags, size_t page_cnt,
+						 size_t align_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t pool_cnt = bitmap_size(pool->used_map);
+	size_t page_idx = (align_cnt - pg_no(pool->base) % align_cnt) % align_cnt;
+	void *pages = NULL;
 
 	lock_acquire(&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+	for (; page_idx + page_cnt <= pool_cnt; page_idx += align_cnt) {
+		if (bitmap_none(pool->used_map, page_idx, page_cnt)) {
+			bitmap_set_multiple(pool->used_map, page_idx, page_cnt, true);
+			pool_count_free(pool, -(long)page_cnt);
+			pages = pool->base + PGSIZE * page_idx;
+			break;
+		}
+	}
 	lock_release(&pool->lock);
-	void *pages;
-
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
 
 	if (pages) {
 		if (flags & PAL_ZERO)
@@ -286,10 +364,51 @@ void *palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
 		if (flags & PAL_ASSERT)
 			PANIC("palloc_get: out of pages");
 	}
-
 	return pages;
 }
 
+/* Obtains the page at PAGE if it is free.  Returns false if the
+   page is already in use. */
+bool palloc_get_page_at(void *page) {
+	struct pool *pool;
+	size_t page_idx;
+	bool success;
+
+	ASSERT(pg_ofs(page) == 0);
+	if (page_from_pool(&kernel_pool, page))
+		pool = &kernel_pool;
+	else if (page_from_pool(&user_pool, page))
+		pool = &user_pool;
+	else
+		NOT_REACHED();
+
+	page_idx = pg_no(page) - pg_no(pool->base);
+	lock_acquire(&pool->lock);
+	success = !bitmap_test(pool->used_map, page_idx);
+	if (success) {
+		bitmap_mark(pool->used_map, page_idx);
+		pool_count_free(pool, -1);
+	}
+	lock_release(&pool->lock);
+	return success;
+}
+
+/* Returns true if PAGE is free.  The pool lock is not taken, so
+   the answer is only a hint for callers that check again later. */
+bool palloc_page_is_free(void *page) {
+	const struct pool *pool;
+
+	ASSERT(pg_ofs(page) == 0);
+	if (page_from_pool(&kernel_pool, page))
+		pool = &kernel_pool;
+	else if (page_from_pool(&user_pool, page))
+		pool = &user_pool;
+	else
+		NOT_REACHED();
+
+	return !bitmap_test(pool->used_map, pg_no(page) - pg_no(pool->base));
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -324,6 +443,50 @@ void palloc_free_multiple(void *pages, size_t page_cnt) {
 #endif
 	ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+	pool_count_free(pool, page_cnt);
+	if (pool == &kernel_pool && free_counter != NULL && !intr_context() &&
+		free_counter == thread_current())
+		counted_free_cnt += page_cnt;
+}
+
+/* Starts counting kernel pages freed by the running thread.
+   Only one thread counts at a time. */
+void palloc_count_begin(void) {
+	ASSERT(free_counter == NULL);
+	counted_free_cnt = 0;
+	free_counter = thread_current();
+}
+
+/* Stops counting and returns the number of kernel pages freed
+   since palloc_count_begin(). */
+size_t palloc_count_end(void) {
+	ASSERT(free_counter == thread_current());
+	free_counter = NULL;
+	return counted_free_cnt;
+}
+
+/* Returns the number of pages kernel pool lacks from what it keeps
+   before lending pages to user allocation. */
+size_t palloc_kernel_shortage(void) {
+	size_t keep_cnt = bitmap_size(kernel_pool.used_map) / LEND_RATIO;
+	size_t free_cnt = kernel_pool.free_cnt;
+
+	return free_cnt < keep_cnt ? keep_cnt - free_cnt : 0;
+}
+
+/* Returns the number of free user pages lacking from the reserve
+   for kernel allocation. */
+size_t palloc_reserve_shortage(void) {
+	size_t free_cnt = user_pool.free_cnt;
+
+	return free_cnt < kernel_reserve ? kernel_reserve - free_cnt : 0;
+}
+
+/* Prints page allocator statistics. */
+void palloc_print_stats(void) {
+	printf("palloc: %zu kernel and %zu user pages free, "
+		   "%llu lent to user, %llu borrowed from user\n",
+		   kernel_pool.free_cnt, user_pool.free_cnt, lend_cnt, borrow_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -348,6 +511,29 @@ static void init_pool(struct pool *p, void **bm_base, uint64_t start,
 	*bm_base += bm_pages;
 }
 
+/* Obtains PAGE_CNT contiguous free pages from POOL, leaving at
+   least KEEP_CNT pages free.  Returns a null pointer on failure. */
+static void *pool_get(struct pool *pool, size_t page_cnt, size_t keep_cnt) {
+	size_t page_idx = BITMAP_ERROR;
+
+	lock_acquire(&pool->lock);
+	if (pool->free_cnt >= page_cnt + keep_cnt)
+		page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR)
+		pool_count_free(pool, -(long)page_cnt);
+	lock_release(&pool->lock);
+
+	return page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+}
+
+/* Adds DELTA to the number of free pages of POOL.  Pages are
+   freed without the pool lock, so interrupts are turned off. */
+static void pool_count_free(struct pool *pool, long delta) {
+	enum intr_level old_level = intr_disable();
+	pool->free_cnt += delta;
+	intr_set_level(old_level);
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool page_from_pool(const struct pool *pool, void *page) {
@@ -71,6 +71,32 @@ void sema_down(struct semaphore *sema) {
 	intr_set_level(old_level);
 }
 
+/* Down or "P" operation on a semaphore like sema_down(), but
+   returns false without decrementing if the current thread is
+   killed by thread_kill() before or while waiting. */
+bool sema_down_killable(struct semaphore *sema) {
+	struct thread *curr = thread_current();
+	enum intr_level old_level;
+
+	ASSERT(sema != NULL);
+	ASSERT(!intr_context());
+
+	old_level = intr_disable();
+	while (sema->value == 0) {
+		if (curr->killed) {
+			intr_set_level(old_level);
+			return false;
+		}
+		list_push_back(&sema->waiters, &curr->status_elem);
+		curr->killable_sema = sema;
+		thread_block();
+		curr->killable_sema = NULL;
+	}
+	sema->value--;
+	intr_set_level(old_level);
+	return true;
+}
+
 /* Down or "P" operation on a semaphore, but only if the
    semaphore is not already 0.  Returns true if the semaphore is
    decremented, false otherwise.
@@ -625,6 +625,23 @@ void thread_sleep(int64_t wake_tick) {
 	intr_set_level(old_level);
 }
 
+/* Make thread T exit before it returns to user mode next time. T sleeping
+   in sema_down_killable() is woken up. */
+void thread_kill(struct thread *t) {
+	enum intr_level old_level;
+
+	ASSERT(is_thread(t));
+
+	old_level = intr_disable();
+	t->killed = true;
+	if (t->status == THREAD_BLOCKED && t->killable_sema) {
+		list_remove(&t->status_elem);
+		t->killable_sema = NULL;
+		thread_unblock(t);
+	}
+	intr_set_level(old_level);
+}
+
 /* Helper function to sort least remained ticks first */
 bool sort_by_tick_ascending(const struct list_elem *a,
 							const struct list_elem *b, void *aux UNUSED) {
@@ -753,6 +770,20 @@ void thread_reset_real_priority(void) {
 	intr_set_level(old_level);
 }
 
+/* Invoke FUNC on every thread with AUX.
+   Need interrupts off before call this */
+void thread_foreach(thread_action_func *func, void *aux) {
+	struct list_elem *cur_thread_elem;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (cur_thread_elem = list_begin(&thread_list);
+		 cur_thread_elem != list_end(&thread_list);
+		 cur_thread_elem = list_next(cur_thread_elem)) {
+		func(ptr_thread(cur_thread_elem), aux);
+	}
+}
+
 // For 4BSD Scheduler
 /* Recalculate prioriry of all thread every 4 ticks.
    Called by timer_interrupt in timer.c */
@@ -1,6 +1,8 @@
 #include "userprog/fd.h"
 #include <stddef.h>
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include <syscall-nr.h>
 #include <stdio.h>
 #include "devices/input.h"
 
@@ -156,6 +158,23 @@ int fd_dup2(int oldfd, int newfd, fd_list fd_list) {
 	return newfd;
 }
 
+/* Pass ADVICE on how fd will be read to its inode. */
+int fd_advise(int fd, off_t offset, off_t length, int advice,
+			  fd_list fd_list) {
+	struct file *file;
+
+	file = fd_get_file(fd, fd_list);
+	if (!file || file == stdin || file == stdout) {
+		return -1;
+	}
+	if (offset < 0 || length < 0 || advice < FADV_NORMAL ||
+		advice > FADV_DONTNEED) {
+		return -1;
+	}
+	inode_advise(file_get_inode(file), offset, length, advice);
+	return 0;
+}
+
 /* Close all fd. Called in process_init and process_exit */
 void fd_close_all(fd_list fd_list) {
 	for (int fd = 0; fd < FDSIZE; ++fd) {
@@ -230,6 +230,8 @@ static void __do_fork(void *aux) {
 	if (!supplemental_page_table_copy(&current_thread->spt, &parent_thread->spt))
 		goto error;
 	mmap_table_init(&current_thread->mt);
+	if (!mmap_table_copy(&current_thread->mt, &parent_thread->mt))
+		goto error;
 #else
 	if (!pml4_for_each(parent_thread->pml4, duplicate_pte, parent_thread))
 		goto error;
@@ -298,6 +300,10 @@ int process_exec(void *f_name) {
 	palloc_free_page(file_name);
 	if (!success)
 		return -1;
+#ifdef VM
+	/* Claim pages this executable faulted on last time */
+	vm_exec_prefetch(process_current()->loaded_file);
+#endif
 
 	/* Start switched process. */
 	do_iret(&_if);
@@ -339,7 +345,11 @@ int process_wait(tid_t child_tid) {
 	if (!child) {
 		return -1;
 	}
-	sema_down(&child->exist_status_setted);
+	/* Killed while waiting, let CHILD exit without being waited */
+	if (!sema_down_killable(&child->exist_status_setted)) {
+		sema_up(&child->parent_waited);
+		return -1;
+	}
 	exist_status = child->exist_status;
 	sema_up(&child->parent_waited);
 	return exist_status;
@@ -356,6 +366,9 @@ void process_exit(void) {
 	/* Check this thread did process_init() */
 	if (curr->is_process) {
 		printf("%s: exit(%d)\n", curr->thread.name, curr->exist_status);
+#ifdef VM
+		spt_print_acct(&curr->thread.spt, curr->thread.name);
+#endif
 	}
 	process_cleanup();
 	sema_up(&curr->exist_status_setted);
@@ -769,23 +782,6 @@ static bool install_page(void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool lazy_load_segment(struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-	void *kva = page->kva;
-	struct vm_file_arg *arg = aux;
-
-	file_seek(arg->file, arg->ofs);
-	if (file_read(arg->file, kva, arg->read_bytes) != (int)arg->read_bytes) {
-		free(aux);
-		return false;
-	}
-	memset(kva + arg->read_bytes, 0, arg->zero_bytes);
-	free(aux);
-	return true;
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -815,19 +811,39 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+		/* Nothing to read, so leave it as untouched anonymous page.
+		 * Read fault on it maps the shared zero page. */
+		if (page_read_bytes == 0) {
+			if (!vm_alloc_page(VM_ANON, upage, writable))
+				return false;
+			zero_bytes -= page_zero_bytes;
+			upage += PGSIZE;
+			continue;
+		}
+
 		arg = malloc(sizeof(struct vm_file_arg));
 		if (!arg) {
 			return false;
 		}
-		arg->file = file;
+		/* Each page holds its own reference, so that a forked process can
+		 * load it even after this process closed the file. */
+		arg->file = file_plus_open_cnt(file);
+		if (!arg->file) {
+			free(arg);
+			return false;
+		}
 		arg->ofs = ofs;
 		arg->read_bytes = page_read_bytes;
 		arg->zero_bytes = page_zero_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage, writable,
-											lazy_load_segment, arg))
+		/* Page keeps where it came from, so that it is read again from the
+		 * file instead of swap while it is clean. */
+		if (!vm_alloc_origin_page(upage, writable, arg)) {
+			file_close(arg->file);
+			free(arg);
 			return false;
+		}
 
 		/* Advance. */
 		ofs += page_read_bytes;
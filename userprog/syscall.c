@@ -12,6 +12,8 @@
 #include "userprog/process.h"
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 #include "filesys/filesys.h"
 #ifdef VM
 #include "vm/file.h"
@@ -20,6 +22,7 @@
 void syscall_entry(void);
 void syscall_handler(struct intr_frame *);
 void syscall_check_vaddr(struct intr_frame *, uint64_t, bool);
+void syscall_check_buffer(struct intr_frame *, uint64_t, size_t, bool);
 
 /* System call.
  *
@@ -53,13 +56,31 @@ void syscall_check_vaddr(struct intr_frame *f, uint64_t va, bool write) {
 #ifndef VM
 	int temp = *(int *)va;
 #else
-	if (!vm_try_handle_fault(f, (void *)va, true, write, false)) {
+	/* Not present page is claimed, shared page is broken for write */
+	if (!vm_try_handle_fault(
+			f, (void *)va, true, write,
+			pml4_get_page(thread_current()->pml4, (void *)va) == NULL)) {
 		exit_with_exit_status(-1);
 	}
 #endif
 	return;
 }
 
+/* Check every page of buffer [VA, VA + SIZE), not only the first byte.
+ * Kernel must not write into a frame shared with other processes. */
+void syscall_check_buffer(struct intr_frame *f, uint64_t va, size_t size,
+						  bool write) {
+	uint64_t end = va + size;
+
+	if (end < va) {
+		exit_with_exit_status(-1);
+	}
+	syscall_check_vaddr(f, va, write);
+	for (va = (uint64_t)pg_round_down(va) + PGSIZE; va < end; va += PGSIZE) {
+		syscall_check_vaddr(f, va, write);
+	}
+}
+
 /* The main system call interface */
 /*
    Input argument
@@ -70,6 +91,11 @@ void syscall_check_vaddr(struct intr_frame *f, uint64_t va, bool write) {
 */
 void syscall_handler(struct intr_frame *f) {
 	struct process *current = process_current();
+
+	/* Killed while running in user mode */
+	if (current->thread.killed) {
+		exit_with_exit_status(-1);
+	}
 	// Projects 2 syscall
 	switch (f->R.rax) {
 	case SYS_HALT:
@@ -116,11 +142,11 @@ void syscall_handler(struct intr_frame *f) {
 		f->R.rax = fd_filesize(f->R.rdi, *current->fd_list);
 		break;
 	case SYS_READ:
-		syscall_check_vaddr(f, f->R.rsi, true);
+		syscall_check_buffer(f, f->R.rsi, f->R.rdx, true);
 		f->R.rax = fd_read(f->R.rdi, (void *)f->R.rsi, f->R.rdx, *current->fd_list);
 		break;
 	case SYS_WRITE:
-		syscall_check_vaddr(f, f->R.rsi, false);
+		syscall_check_buffer(f, f->R.rsi, f->R.rdx, false);
 		f->R.rax = fd_write(f->R.rdi, (void *)f->R.rsi, f->R.rdx, *current->fd_list);
 		break;
 	case SYS_SEEK:
@@ -138,12 +164,34 @@ void syscall_handler(struct intr_frame *f) {
 #ifdef VM
 	case SYS_MMAP:
 		f->R.rax = (uint64_t)do_mmap((void *)f->R.rdi, f->R.rsi, f->R.rdx,
-									 fd_get_file(f->R.r10, *current->fd_list), f->R.r8);
+									 fd_get_file(f->R.r10, *current->fd_list), f->R.r8,
+									 f->R.r9);
 		break;
 	case SYS_MUNMAP:
 		do_munmap((void *)f->R.rdi);
 		break;
+	case SYS_MADVISE:
+		f->R.rax = do_madvise((void *)f->R.rdi, f->R.rsi, f->R.rdx);
+		break;
+	case SYS_RSSLIMIT:
+		f->R.rax = vm_set_rss_limit(f->R.rdi);
+		break;
+	case SYS_OOMADJ:
+		f->R.rax = vm_set_oom_adj(f->R.rdi);
+		break;
+	case SYS_MEMPRESSURE:
+		f->R.rax = vm_mem_pressure();
+		break;
+	case SYS_FAULTSTAT:
+		syscall_check_buffer(f, f->R.rdi,
+							 sizeof(struct fault_stat) * FAULT_TYPE_CNT, true);
+		f->R.rax = vm_get_fault_stat((void *)f->R.rdi, f->R.rsi);
+		break;
 #endif
+	case SYS_FADVISE:
+		f->R.rax = fd_advise(f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10,
+							 *current->fd_list);
+		break;
 #ifdef EFILESYS
 	case SYS_CHDIR:
 	case SYS_MKDIR:
@@ -158,4 +206,8 @@ void syscall_handler(struct intr_frame *f) {
 		printf("system call %lld not maid\n", f->R.rax);
 		exit_with_exit_status(-1);
 	}
+	/* Killed while in the system call */
+	if (current->thread.killed) {
+		exit_with_exit_status(-1);
+	}
 }
@@ -5,6 +5,10 @@
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/mmu.h"
+#include "vm/zswap.h"
+#include "filesys/file.h"
+#include <string.h>
+#include <stdio.h>
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -15,10 +19,49 @@ static void anon_destroy(struct page *page);
 static void swap_write(disk_sector_t sec_no, const void *buffer);
 static void swap_read(disk_sector_t sec_no, void *buffer);
 
-static struct bitmap *swap_bitmap;
+static disk_sector_t swap_alloc(void);
+static void swap_get(disk_sector_t sec_no);
+static void swap_put(disk_sector_t sec_no);
+
+/* Swap device. Slots are numbered through all devices, and the device
+ * holds slots from BASE to BASE + SLOT_CNT. */
+struct swap_dev {
+	struct disk *disk;
+	struct bitmap *bitmap; /* One bit per slot, protected by swap_lock */
+	size_t base;
+	size_t slot_cnt;
+	size_t free_cnt;	 /* Protected by swap_lock */
+	int chan;			 /* IDE channel, 0 or 1 */
+};
+
+/* One swap device per ATA disk at most */
+#define SWAP_DEV_MAX 4
+char *swap_devices;
+static struct swap_dev swap_devs[SWAP_DEV_MAX];
+static size_t swap_dev_cnt;
+/* Device to try first among equally busy ones */
+static size_t swap_cursor;
+/* Transfers in progress per IDE channel, by swap_busy_lock. Devices on one
+ * channel share its lock, so a channel is busy or not as a whole. */
+static int swap_chan_busy[2];
+/* Number of pages referring each swap slot, a slot is SEC_WRITE_CNT
+ * sectors. */
+static uint16_t *swap_ref;
 static struct lock swap_lock;
+/* Only held to count a swap disk transfer, nothing is taken under it */
+static struct lock swap_busy_lock;
 static disk_sector_t sec_cnt;
 
+/* Statistics. */
+static uint64_t swap_write_cnt;	 /* # of pages written to swap. */
+static uint64_t clean_drop_cnt;	 /* # of clean pages dropped. */
+static uint64_t cache_drop_cnt;	 /* # of pages dropped, still in swap. */
+static uint64_t writeback_cnt;	 /* # of pages written while resident. */
+
+/* Convert swap slot index to first sector and vice versa */
+#define stos(slot) ((disk_sector_t)((slot)*SEC_WRITE_CNT))
+#define stoslot(sec_no) ((size_t)((sec_no) / SEC_WRITE_CNT))
+
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
 	.swap_in = anon_swap_in,
@@ -27,13 +70,54 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Add ATA disk named by TOKEN, "CHAN:DEV", as a swap device. */
+static void swap_add_dev(const char *token) {
+	struct swap_dev *dev = &swap_devs[swap_dev_cnt];
+
+	if (strlen(token) != 3 || token[1] != ':' || token[0] < '0' ||
+		token[0] > '1' || token[2] < '0' || token[2] > '1') {
+		PANIC("bad swap device `%s'", token);
+	}
+	if (swap_dev_cnt == SWAP_DEV_MAX) {
+		PANIC("too many swap devices");
+	}
+	if (!(dev->disk = disk_get(token[0] - '0', token[2] - '0'))) {
+		PANIC("swap device %s not found", token);
+	}
+	for (size_t idx = 0; idx < swap_dev_cnt; ++idx) {
+		if (swap_devs[idx].disk == dev->disk) {
+			PANIC("swap device %s given twice", token);
+		}
+	}
+	dev->chan = token[0] - '0';
+	dev->base = stoslot(sec_cnt);
+	dev->slot_cnt = stoslot(disk_size(dev->disk));
+	dev->free_cnt = dev->slot_cnt;
+	if (!(dev->bitmap = bitmap_create(dev->slot_cnt))) {
+		PANIC("swap table init fail");
+	}
+	sec_cnt += stos(dev->slot_cnt);
+	swap_dev_cnt++;
+}
+
 /* Initialize the data for anonymous pages */
 void vm_anon_init(void) {
+	char devices[16], *token, *save_ptr;
+
 	/* TODO: Set up the swap_disk. */
-	swap_disk = disk_get(1, 1);
-	sec_cnt = disk_size(swap_disk);
-	swap_bitmap = bitmap_create(sec_cnt);
+	strlcpy(devices, swap_devices ? swap_devices : "1:1", sizeof devices);
+	for (token = strtok_r(devices, ",", &save_ptr); token != NULL;
+		 token = strtok_r(NULL, ",", &save_ptr)) {
+		swap_add_dev(token);
+	}
+	swap_disk = swap_devs[0].disk;
+	swap_ref = calloc(stoslot(sec_cnt), sizeof(uint16_t));
+	if (!swap_ref) {
+		PANIC("swap table init fail");
+	}
 	lock_init(&swap_lock);
+	lock_init(&swap_busy_lock);
+	zswap_init(swap_write);
 }
 
 /* Initialize the file mapping */
@@ -45,7 +129,119 @@ bool anon_initializer(struct page *page, enum vm_type type, void *kva) {
 
 	struct anon_page *anon_page = &page->anon;
 	anon_page->sec_no = BITMAP_ERROR;
+	anon_page->origin = NULL;
+
+	return true;
+}
+
+/* Forget the executable content of PAGE, which is not same anymore. */
+static void anon_drop_origin(struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->origin) {
+		file_close(anon_page->origin->file);
+		free(anon_page->origin);
+		anon_page->origin = NULL;
+	}
+}
+
+/* Forget the swap slot which resident PAGE was read from. */
+static void anon_drop_swap_cache(struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->sec_no != BITMAP_ERROR) {
+		swap_put(anon_page->sec_no);
+		anon_page->sec_no = BITMAP_ERROR;
+	}
+}
+
+/* Return true if resident PAGE read from swap keeps its slot, so that it
+ * is dropped without writing when evicted clean. Slots are given back
+ * once half of swap is used. */
+static bool anon_keep_swap_cache(void) {
+	size_t total, used = anon_swap_usage(&total);
+
+	return used * 2 < total;
+}
+
+/* Return the swap slot still same as the frame PAGE_LIST is on, or
+ * BITMAP_ERROR if there is none or some page wrote the frame. */
+static disk_sector_t anon_cached_slot(struct list *page_list) {
+	struct list_elem *page_elem;
+	struct page *page;
+	disk_sector_t sec_no = BITMAP_ERROR;
 
+	for (page_elem = list_begin(page_list); page_elem != list_end(page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (pml4_is_dirty(page->pml4, page->va)) {
+			return BITMAP_ERROR;
+		}
+		if (page->anon.sec_no != BITMAP_ERROR) {
+			sec_no = page->anon.sec_no;
+		}
+	}
+	return sec_no;
+}
+
+/* Forget the origin and swap slot of resident PAGE if it was written.
+ * Call this before the page table entry of PAGE is replaced, which loses
+ * the dirty bit. */
+void anon_check_dirty(struct page *page) {
+	if (page->operations == &anon_ops &&
+		pml4_is_dirty(page->pml4, page->va)) {
+		anon_drop_origin(page);
+		anon_drop_swap_cache(page);
+	}
+}
+
+/* Return true if PAGE is not in memory nor in swap, but in its executable */
+bool anon_in_origin(struct page *page) {
+	return page->operations == &anon_ops && !vm_on_phymem(page) &&
+		   page->anon.sec_no == BITMAP_ERROR && page->anon.origin;
+}
+
+/* Return true if evicting the frame PAGE_LIST is on takes a swap slot. */
+bool anon_needs_slot(struct list *page_list) {
+	struct page *page =
+		list_entry(list_front(page_list), struct page, page_elem);
+
+	if (page->operations != &anon_ops || anon_is_text(page)) {
+		return false;
+	}
+	/* Frame still same as its swap slot is dropped */
+	if (anon_cached_slot(page_list) != BITMAP_ERROR) {
+		return false;
+	}
+	/* Sole page same as the executable is dropped */
+	return list_front(page_list) != list_back(page_list) ||
+		   !page->anon.origin || pml4_is_dirty(page->pml4, page->va);
+}
+
+/* Return number of swap slots in use, and number of all slots in TOTAL. */
+size_t anon_swap_usage(size_t *total) {
+	size_t free_cnt = 0;
+
+	lock_acquire(&swap_lock);
+	for (size_t idx = 0; idx < swap_dev_cnt; ++idx) {
+		free_cnt += swap_devs[idx].free_cnt;
+	}
+	lock_release(&swap_lock);
+	*total = stoslot(sec_cnt);
+	return *total - free_cnt;
+}
+
+/* Read content of PAGE from its executable into KVA. */
+static bool anon_load_origin(struct page *page, void *kva) {
+	struct vm_file_arg *origin = page->anon.origin;
+
+	/* The file may be shared with forked processes, so keep off its pos */
+	if (!vm_prefetch_copy(origin, kva) &&
+		file_read_at(origin->file, kva, origin->read_bytes, origin->ofs) !=
+			(int)origin->read_bytes) {
+		return false;
+	}
+	memset(kva + origin->read_bytes, 0, origin->zero_bytes);
 	return true;
 }
 
@@ -53,15 +249,25 @@ bool anon_initializer(struct page *page, enum vm_type type, void *kva) {
 static bool anon_swap_in(struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
 
-	ASSERT(bitmap_all(swap_bitmap, anon_page->sec_no, SEC_WRITE_CNT));
 	ASSERT(page->kva == NULL);
 
-	swap_read(anon_page->sec_no, kva);
-	lock_acquire(&swap_lock);
-	bitmap_set_multiple(swap_bitmap, anon_page->sec_no, SEC_WRITE_CNT, false);
-	lock_release(&swap_lock);
-	anon_page->sec_no = BITMAP_ERROR;
+	if (anon_page->sec_no == BITMAP_ERROR) {
+		ASSERT(anon_page->origin != NULL);
+		if (!anon_load_origin(page, kva)) {
+			return false;
+		}
+		page->kva = kva;
+		return true;
+	}
+	if (!zswap_load(anon_page->sec_no, kva)) {
+		swap_read(anon_page->sec_no, kva);
+	}
+	vm_acct_swap(page, -1);
 	page->kva = kva;
+	/* Slot is kept as swap cache while the page is clean */
+	if (!anon_keep_swap_cache()) {
+		anon_drop_swap_cache(page);
+	}
 
 	return true;
 }
@@ -70,45 +276,295 @@ static bool anon_swap_in(struct page *page, void *kva) {
 static bool anon_swap_out(struct page *page) {
 	struct anon_page *anon_page = &page->anon;
 
-	ASSERT(anon_page->sec_no == BITMAP_ERROR);
 	ASSERT(page->kva != NULL);
 
-	lock_acquire(&swap_lock);
-	anon_page->sec_no = bitmap_scan_and_flip(swap_bitmap, 0, SEC_WRITE_CNT, false);
-	lock_release(&swap_lock);
+	/* Page same as its swap slot is read again from the slot */
+	if (anon_page->sec_no != BITMAP_ERROR) {
+		if (!pml4_is_dirty(page->pml4, page->va)) {
+			vm_acct_swap(page, 1);
+			page->kva = NULL;
+			cache_drop_cnt++;
+			return true;
+		}
+		anon_drop_swap_cache(page);
+	}
+	/* Page same as the executable is loaded again from the file */
+	if (anon_page->origin) {
+		if (!page->writable || !pml4_is_dirty(page->pml4, page->va)) {
+			page->kva = NULL;
+			clean_drop_cnt++;
+			return true;
+		}
+		anon_drop_origin(page);
+	}
+	anon_page->sec_no = swap_alloc();
 	if (anon_page->sec_no == BITMAP_ERROR) {
 		return false;
 	}
-	swap_write(anon_page->sec_no, page->kva);
+	if (!zswap_store(anon_page->sec_no, page->kva)) {
+		swap_write(anon_page->sec_no, page->kva);
+	}
+	swap_write_cnt++;
+	vm_acct_swap(page, 1);
 	page->kva = NULL;
 
 	return true;
 }
 
+/* Write resident PAGE to a swap slot kept as its swap cache, so that
+ * eviction drops it without writing. The page stays mapped; its dirty bit
+ * is cleared before the write, so a write meanwhile makes it dirty again.
+ * Return false if PAGE is clean already, in a 2 MB mapping, or swap runs
+ * short. Need frame_lock of PAGE's frame before call this */
+bool anon_writeback(struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+	uint64_t *pte = pml4e_walk(page->pml4, (uint64_t)page->va, 0);
+	disk_sector_t sec_no;
+
+	ASSERT(page->operations == &anon_ops);
+	ASSERT(page->kva != NULL);
+
+	/* Dirty bit of huge mapping is shared by 512 pages */
+	if (!pte || (*pte & PTE_PS) || anon_is_text(page) ||
+		!pml4_is_dirty(page->pml4, page->va) || !anon_keep_swap_cache()) {
+		return false;
+	}
+	anon_drop_swap_cache(page);
+	if ((sec_no = swap_alloc()) == BITMAP_ERROR) {
+		return false;
+	}
+	anon_drop_origin(page);
+	pml4_set_dirty(page->pml4, page->va, false);
+	if (!zswap_store(sec_no, page->kva)) {
+		swap_write(sec_no, page->kva);
+	}
+	anon_page->sec_no = sec_no;
+	writeback_cnt++;
+
+	return true;
+}
+
+/* Swap out every anonymous page on PAGE_LIST, which share one frame.
+ * The frame is written once to a single swap slot referred by all of them,
+ * or not at all if a sharer still has the same content in its slot. */
+bool anon_swap_out_shared(struct list *page_list) {
+	struct list_elem *page_elem;
+	struct page *page;
+	disk_sector_t sec_no;
+	bool is_cached;
+	void *kva;
+
+	ASSERT(!list_empty(page_list));
+
+	page = list_entry(list_front(page_list), struct page, page_elem);
+	kva = page->kva;
+	/* Frame of text cache holds only text pages */
+	if (anon_is_text(page)) {
+		for (page_elem = list_begin(page_list);
+			 page_elem != list_end(page_list);
+			 page_elem = list_next(page_elem)) {
+			page = list_entry(page_elem, struct page, page_elem);
+			ASSERT(anon_is_text(page));
+			page->kva = NULL;
+		}
+		clean_drop_cnt++;
+		return true;
+	}
+	sec_no = anon_cached_slot(page_list);
+	is_cached = sec_no != BITMAP_ERROR;
+	/* Other slots are stale or hold the same content */
+	for (page_elem = list_begin(page_list); page_elem != list_end(page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (page->anon.sec_no != sec_no) {
+			anon_drop_swap_cache(page);
+		}
+	}
+	if (is_cached) {
+		cache_drop_cnt++;
+	} else {
+		sec_no = swap_alloc();
+		if (sec_no == BITMAP_ERROR) {
+			return false;
+		}
+		if (!zswap_store(sec_no, kva)) {
+			swap_write(sec_no, kva);
+		}
+		swap_write_cnt++;
+	}
+	for (page_elem = list_begin(page_list); page_elem != list_end(page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+
+		ASSERT(page->operations == &anon_ops);
+		ASSERT(page->kva == kva);
+		ASSERT(page->anon.sec_no == BITMAP_ERROR ||
+			   page->anon.sec_no == sec_no);
+
+		if (page->anon.sec_no == BITMAP_ERROR) {
+			swap_get(sec_no);
+			page->anon.sec_no = sec_no;
+		}
+		/* Sharers are not checked for dirty, swap is the only copy now */
+		anon_drop_origin(page);
+		page->kva = NULL;
+		vm_acct_swap(page, 1);
+	}
+	/* Reference of swap_alloc is taken by the sharers */
+	if (!is_cached) {
+		swap_put(sec_no);
+	}
+	return true;
+}
+
+/* Bring in PAGE which shares swap slot with a page already swapped in to
+ * KVA. No disk I/O is needed. */
+void anon_share_in(struct page *page, void *kva) {
+	struct anon_page *anon_page = &page->anon;
+
+	ASSERT(page->operations == &anon_ops);
+	ASSERT(anon_page->sec_no != BITMAP_ERROR);
+	ASSERT(page->kva == NULL);
+
+	page->kva = kva;
+	vm_acct_swap(page, -1);
+	if (!anon_keep_swap_cache()) {
+		anon_drop_swap_cache(page);
+	}
+}
+
+/* Make DST refer the swap slot of swapped out anonymous page SRC.
+ * DST should be initialized as anonymous page without frame. */
+void anon_share_swap(struct page *dst, struct page *src) {
+	ASSERT(src->operations == &anon_ops && dst->operations == &anon_ops);
+	ASSERT(!vm_on_phymem(src) && !vm_on_phymem(dst));
+	ASSERT(src->anon.sec_no != BITMAP_ERROR);
+
+	swap_get(src->anon.sec_no);
+	dst->anon.sec_no = src->anon.sec_no;
+	vm_acct_swap(dst, 1);
+}
+
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void anon_destroy(struct page *page) {
 	struct anon_page *anon_page = &page->anon;
 	if (!vm_on_phymem(page)) {
-		ASSERT(anon_page->sec_no != BITMAP_ERROR);
-		ASSERT(bitmap_all(swap_bitmap, anon_page->sec_no, SEC_WRITE_CNT));
+		ASSERT(anon_page->sec_no != BITMAP_ERROR || anon_page->origin);
 
-		lock_acquire(&swap_lock);
-		bitmap_set_multiple(swap_bitmap, anon_page->sec_no, SEC_WRITE_CNT, false);
-		lock_release(&swap_lock);
-		anon_page->sec_no = BITMAP_ERROR;
+		if (anon_page->sec_no != BITMAP_ERROR) {
+			vm_acct_swap(page, -1);
+		}
 	}
+	anon_drop_swap_cache(page);
+	anon_drop_origin(page);
+}
+
+/* Prints swap statistics. */
+void anon_print_stats(void) {
+	printf("Swap: %llu pages written, %llu clean pages dropped, "
+		   "%llu dropped by swap cache\n",
+		   swap_write_cnt, clean_drop_cnt, cache_drop_cnt);
+	printf("Swap: %llu pages written back while resident\n", writeback_cnt);
+	for (size_t idx = 0; idx < swap_dev_cnt; ++idx) {
+		printf("Swap: device %zu, %zu of %zu slots used\n", idx,
+			   swap_devs[idx].slot_cnt - swap_devs[idx].free_cnt,
+			   swap_devs[idx].slot_cnt);
+	}
+}
+
+/* Return swap device holding swap slot SLOT. */
+static struct swap_dev *swap_dev_of(size_t slot) {
+	for (size_t idx = 0; idx < swap_dev_cnt; ++idx) {
+		if (slot < swap_devs[idx].base + swap_devs[idx].slot_cnt) {
+			return &swap_devs[idx];
+		}
+	}
+	PANIC("swap slot %zu out of range", slot);
+}
+
+/* Allocate a swap slot referred once. Return first sector of the slot,
+ * BITMAP_ERROR if every swap device is full. The slot is placed on a
+ * device of the least busy channel, so that both channels transfer
+ * concurrently. Busy counts are only a hint, read without the lock. */
+static disk_sector_t swap_alloc(void) {
+	struct swap_dev *dev, *best = NULL;
+	size_t slot = BITMAP_ERROR;
+
+	lock_acquire(&swap_lock);
+	for (size_t idx = 0; idx < swap_dev_cnt; ++idx) {
+		dev = &swap_devs[(swap_cursor + idx) % swap_dev_cnt];
+		if (dev->free_cnt &&
+			(!best || swap_chan_busy[dev->chan] < swap_chan_busy[best->chan])) {
+			best = dev;
+		}
+	}
+	if (best) {
+		slot = bitmap_scan_and_flip(best->bitmap, 0, 1, false);
+		ASSERT(slot != BITMAP_ERROR);
+		best->free_cnt--;
+		slot += best->base;
+		swap_ref[slot] = 1;
+		swap_cursor = (best - swap_devs + 1) % swap_dev_cnt;
+	}
+	lock_release(&swap_lock);
+	return slot == BITMAP_ERROR ? BITMAP_ERROR : stos(slot);
+}
+
+/* Add a reference to swap slot start at SEC_NO. */
+static void swap_get(disk_sector_t sec_no) {
+	size_t slot = stoslot(sec_no);
+	struct swap_dev *dev = swap_dev_of(slot);
+
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(dev->bitmap, slot - dev->base));
+	swap_ref[slot]++;
+	lock_release(&swap_lock);
+}
+
+/* Drop a reference to swap slot start at SEC_NO, free it on last one. */
+static void swap_put(disk_sector_t sec_no) {
+	size_t slot = stoslot(sec_no);
+	struct swap_dev *dev = swap_dev_of(slot);
+
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(dev->bitmap, slot - dev->base));
+	ASSERT(swap_ref[slot] > 0);
+	if (--swap_ref[slot] == 0) {
+		bitmap_reset(dev->bitmap, slot - dev->base);
+		dev->free_cnt++;
+		zswap_invalidate(sec_no);
+	}
+	lock_release(&swap_lock);
+}
+
+/* Count a transfer of DELTA on channel of DEV, which makes placement
+ * avoid it. */
+static void swap_busy(struct swap_dev *dev, int delta) {
+	lock_acquire(&swap_busy_lock);
+	swap_chan_busy[dev->chan] += delta;
+	lock_release(&swap_busy_lock);
 }
 
 static void swap_write(disk_sector_t sec_no, const void *buffer) {
+	struct swap_dev *dev = swap_dev_of(stoslot(sec_no));
+	disk_sector_t dev_sec_no = sec_no - stos(dev->base);
+
 	ASSERT(sec_no + SEC_WRITE_CNT <= sec_cnt);
+	swap_busy(dev, 1);
 	for (int i = 0; i < SEC_WRITE_CNT; ++i) {
-		disk_write(swap_disk, sec_no + i, buffer + DISK_SECTOR_SIZE * i);
+		disk_write(dev->disk, dev_sec_no + i, buffer + DISK_SECTOR_SIZE * i);
 	}
+	swap_busy(dev, -1);
 }
 
 static void swap_read(disk_sector_t sec_no, void *buffer) {
+	struct swap_dev *dev = swap_dev_of(stoslot(sec_no));
+	disk_sector_t dev_sec_no = sec_no - stos(dev->base);
+
 	ASSERT(sec_no + SEC_WRITE_CNT <= sec_cnt);
+	swap_busy(dev, 1);
 	for (int i = 0; i < SEC_WRITE_CNT; ++i) {
-		disk_read(swap_disk, sec_no + i, buffer + DISK_SECTOR_SIZE * i);
+		disk_read(dev->disk, dev_sec_no + i, buffer + DISK_SECTOR_SIZE * i);
 	}
+	swap_busy(dev, -1);
 }
\ No newline at end of file
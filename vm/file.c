@@ -4,6 +4,7 @@
 #include "threads/malloc.h"
 #include "threads/vaddr.h"
 #include <string.h>
+#include <syscall-nr.h>
 #include "threads/mmu.h"
 
 static bool file_backed_swap_in(struct page *page, void *kva);
@@ -148,21 +149,42 @@ static void file_backed_destroy(struct page *page) {
 	return;
 }
 
-/* Do the mmap */
+/* Allocate zero filled pages of anonymous mapping on PAGE_COUNT pages
+ * from ADDR. Return number of pages allocated. */
+static uint64_t mmap_alloc_anon(void *addr, uint64_t page_count, int writable,
+								bool is_shmem) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	uint64_t idx;
+
+	for (idx = 0; idx < page_count; ++idx) {
+		if (!vm_alloc_page(VM_ANON, addr + idx * PGSIZE, writable)) {
+			break;
+		}
+		spt_find_page(spt, addr + idx * PGSIZE)->is_shmem = is_shmem;
+	}
+	return idx;
+}
+
+/* Do the mmap. FLAGS is combination of MAP_* flags.
+ * Anonymous mapping ignores FILE and OFFSET. Shared anonymous mapping is
+ * always populated, so that forked children share its frames. */
 void *do_mmap(void *addr, size_t length, int writable, struct file *file,
-			  off_t offset) {
+			  off_t offset, int flags) {
 	struct vm_file_arg *file_arg;
 	struct mmap *mmap = NULL;
 	struct supplemental_page_table *spt;
 	struct mmap_table *mt;
 	void *alloc_addr;
-	uint64_t alloced_idx;
+	uint64_t alloced_idx = 0;
 	uint64_t page_count;
+	bool is_anon = flags & MAP_ANONYMOUS;
 
 	// check validating input
-	if (file == NULL || file == stdin || file == stdout ||
-		!length || !file_length(file) || pg_ofs(offset) ||
-		!addr || pg_ofs(addr)) {
+	if (!is_anon && (file == NULL || file == stdin || file == stdout ||
+					 !file_length(file) || pg_ofs(offset))) {
+		goto mmap_err;
+	}
+	if (!length || !addr || pg_ofs(addr)) {
 		goto mmap_err;
 	}
 	// check over-lap
@@ -183,7 +205,7 @@ void *do_mmap(void *addr, size_t length, int writable, struct file *file,
 	if (!(mmap = calloc(1, sizeof(struct mmap)))) {
 		goto mmap_err;
 	}
-	if (!(mmap->file = file_reopen(file))) {
+	if (!is_anon && !(mmap->file = file_reopen(file))) {
 		goto mmap_err;
 	}
 	mmap->va = addr;
@@ -192,6 +214,14 @@ void *do_mmap(void *addr, size_t length, int writable, struct file *file,
 		PANIC("already same mmap in mt");
 	}
 
+	if (is_anon) {
+		alloced_idx = mmap_alloc_anon(addr, page_count, writable,
+									  flags & MAP_SHARED);
+		if (alloced_idx < page_count) {
+			goto mmap_err;
+		}
+		goto mmap_populate;
+	}
 	alloc_addr = addr;
 	for (alloced_idx = 0; alloced_idx < page_count; ++alloced_idx) {
 		size_t page_read_bytes = length < PGSIZE ? length : PGSIZE;
@@ -218,9 +248,20 @@ void *do_mmap(void *addr, size_t length, int writable, struct file *file,
 		length -= page_read_bytes;
 		alloc_addr += PGSIZE;
 	}
+mmap_populate:
+	/* Fault in whole range now, instead of one by one on access */
+	if (flags & (MAP_POPULATE | MAP_SHARED)) {
+		for (uint64_t idx = 0; idx < page_count; ++idx) {
+			if (!vm_claim_page(addr + idx * PGSIZE)) {
+				do_munmap(addr);
+				return NULL;
+			}
+		}
+	}
 	return addr;
 mmap_err:
 	if (mmap) {
+		hash_delete(&mt->mt_hash, &mmap->mt_elem);
 		if (mmap->file) {
 			file_close(mmap->file);
 		}
@@ -263,6 +304,30 @@ void mmap_table_init(struct mmap_table *mt) {
 	}
 }
 
+/* Copy anonymous mappings of SRC to DST, whose pages are copied by
+ * supplemental_page_table_copy. File mappings are not inherited. */
+bool mmap_table_copy(struct mmap_table *dst, struct mmap_table *src) {
+	struct hash_iterator i;
+	struct mmap *src_mmap, *dst_mmap;
+
+	hash_first(&i, &src->mt_hash);
+	while (hash_next(&i)) {
+		src_mmap = hash_entry(hash_cur(&i), struct mmap, mt_elem);
+		if (src_mmap->file) {
+			continue;
+		}
+		if (!(dst_mmap = calloc(1, sizeof(struct mmap)))) {
+			return false;
+		}
+		dst_mmap->va = src_mmap->va;
+		dst_mmap->page_count = src_mmap->page_count;
+		if (!mt_insert_mmap(dst, dst_mmap)) {
+			PANIC("already same mmap in mt");
+		}
+	}
+	return true;
+}
+
 /* Free the resource hold by the mmap table */
 void mmap_table_kill(struct mmap_table *mt) {
 	hash_clear(&mt->mt_hash, mt_destroy_func);
@@ -0,0 +1,193 @@
+/* prefetch.c: Fault traces of executables, replayed on exec.
+ *
+ * First faults on pages loaded from an executable are recorded per inode
+ * while the program runs. Next exec of the same inode claims the recorded
+ * pages at once, in address order, before the program starts faulting.
+ * Every PREFETCH_REFRESH execs a trace is recorded again, so that it
+ * follows a program whose behavior changed. */
+
+#include "vm/prefetch.h"
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/shrinker.h"
+
+/* Traces kept in memory, least recently used one is dropped above it. */
+#define PREFETCH_TRACE_MAX 32
+/* Execs replaying a trace before it is recorded again */
+#define PREFETCH_REFRESH 8
+
+/* Fault trace of an executable. */
+struct exec_trace {
+	disk_sector_t inumber;
+	size_t cnt;
+	size_t use_cnt;				  /* Execs replayed since recorded */
+	void *va[PREFETCH_TRACE_LEN]; /* Sorted by address */
+	struct hash_elem t_elem;
+	struct list_elem lru_elem;
+};
+
+bool prefetch_enabled;
+
+static struct hash trace_hash;
+/* Most recently used at front. */
+static struct list trace_lru;
+static struct lock trace_lock;
+static size_t trace_cnt;
+
+static struct {
+	uint64_t store_cnt;
+	uint64_t hit_cnt;
+	uint64_t miss_cnt;
+	uint64_t refresh_cnt;
+	uint64_t drop_cnt;
+} prefetch_stat;
+
+static uint64_t trace_hash_func(const struct hash_elem *e, void *aux UNUSED) {
+	struct exec_trace *trace = hash_entry(e, struct exec_trace, t_elem);
+	return hash_int(trace->inumber);
+}
+
+static bool trace_less_func(const struct hash_elem *a,
+							const struct hash_elem *b, void *aux UNUSED) {
+	struct exec_trace *trace_a = hash_entry(a, struct exec_trace, t_elem);
+	struct exec_trace *trace_b = hash_entry(b, struct exec_trace, t_elem);
+	return trace_a->inumber < trace_b->inumber;
+}
+
+/* Find trace of INUMBER. Need trace_lock before call this */
+static struct exec_trace *trace_find(disk_sector_t inumber) {
+	struct exec_trace key = {.inumber = inumber};
+	struct hash_elem *e = hash_find(&trace_hash, &key.t_elem);
+	return e ? hash_entry(e, struct exec_trace, t_elem) : NULL;
+}
+
+/* Sort CNT addresses of VA in ascending order. */
+static void va_sort(void **va, size_t cnt) {
+	void *key;
+	size_t j;
+
+	for (size_t i = 1; i < cnt; ++i) {
+		key = va[i];
+		for (j = i; j > 0 && va[j - 1] > key; --j) {
+			va[j] = va[j - 1];
+		}
+		va[j] = key;
+	}
+}
+
+/* Drop least recently used traces until CNT traces are left.
+ * Need trace_lock before call this */
+static void trace_drop(size_t cnt) {
+	struct exec_trace *trace;
+
+	while (trace_cnt > cnt) {
+		trace = list_entry(list_pop_back(&trace_lru), struct exec_trace,
+						   lru_elem);
+		hash_delete(&trace_hash, &trace->t_elem);
+		free(trace);
+		trace_cnt--;
+		prefetch_stat.drop_cnt++;
+	}
+}
+
+static size_t prefetch_shrink_count(void) {
+	return trace_cnt * sizeof(struct exec_trace) / PGSIZE;
+}
+
+/* Drop least recently used traces of NR_PAGES pages. */
+static void prefetch_shrink_scan(size_t nr_pages) {
+	size_t drop_cnt =
+		DIV_ROUND_UP(nr_pages * PGSIZE, sizeof(struct exec_trace));
+
+	if (lock_held_by_current_thread(&trace_lock) ||
+		!lock_try_acquire(&trace_lock)) {
+		return;
+	}
+	trace_drop(trace_cnt > drop_cnt ? trace_cnt - drop_cnt : 0);
+	lock_release(&trace_lock);
+}
+
+static struct shrinker prefetch_shrinker = {
+	.name = "prefetch",
+	.count = prefetch_shrink_count,
+	.scan = prefetch_shrink_scan,
+};
+
+/* Initialize trace cache. */
+void prefetch_init(void) {
+	if (!hash_init(&trace_hash, trace_hash_func, trace_less_func, NULL)) {
+		PANIC("trace cache init fail");
+	}
+	list_init(&trace_lru);
+	lock_init(&trace_lock);
+	shrinker_register(&prefetch_shrinker);
+}
+
+/* Copy recorded trace of executable INUMBER into VA, which holds
+ * PREFETCH_TRACE_LEN addresses. Return number of addresses, 0 if none or
+ * if the trace should be recorded again by the caller. The old trace is
+ * kept until the new one is stored. */
+size_t prefetch_lookup(disk_sector_t inumber, void **va) {
+	struct exec_trace *trace;
+	size_t cnt = 0;
+
+	lock_acquire(&trace_lock);
+	trace = trace_find(inumber);
+	if (trace && ++trace->use_cnt > PREFETCH_REFRESH) {
+		trace->use_cnt = 0;
+		prefetch_stat.refresh_cnt++;
+	} else if (trace) {
+		cnt = trace->cnt;
+		memcpy(va, trace->va, cnt * sizeof *va);
+		list_remove(&trace->lru_elem);
+		list_push_front(&trace_lru, &trace->lru_elem);
+		prefetch_stat.hit_cnt++;
+	} else {
+		prefetch_stat.miss_cnt++;
+	}
+	lock_release(&trace_lock);
+	return cnt;
+}
+
+/* Record CNT faulted addresses of VA as trace of executable INUMBER,
+ * replacing old one. VA is sorted. */
+void prefetch_store(disk_sector_t inumber, void **va, size_t cnt) {
+	struct exec_trace *trace;
+
+	ASSERT(cnt <= PREFETCH_TRACE_LEN);
+
+	va_sort(va, cnt);
+	lock_acquire(&trace_lock);
+	trace = trace_find(inumber);
+	if (!trace) {
+		if (!(trace = malloc(sizeof *trace))) {
+			lock_release(&trace_lock);
+			return;
+		}
+		trace->inumber = inumber;
+		hash_insert(&trace_hash, &trace->t_elem);
+		list_push_front(&trace_lru, &trace->lru_elem);
+		trace_cnt++;
+	}
+	trace->cnt = cnt;
+	trace->use_cnt = 0;
+	memcpy(trace->va, va, cnt * sizeof *va);
+	prefetch_stat.store_cnt++;
+	trace_drop(PREFETCH_TRACE_MAX);
+	lock_release(&trace_lock);
+}
+
+/* Prints trace cache statistics. */
+void prefetch_print_stats(void) {
+	printf("prefetch: %llu traces stored, %llu dropped, "
+		   "%llu exec hits, %llu misses, %llu refreshed\n",
+		   prefetch_stat.store_cnt, prefetch_stat.drop_cnt,
+		   prefetch_stat.hit_cnt, prefetch_stat.miss_cnt,
+		   prefetch_stat.refresh_cnt);
+}
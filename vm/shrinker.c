@@ -0,0 +1,87 @@
+/* shrinker.c: Caches giving memory back under pressure.
+ *
+ * Each cache registers a shrinker at boot. When reclaim scans some part of
+ * its memory, every cache is scanned the same part of its own size, so
+ * that memory flows away from caches which are not used. */
+
+#include "vm/shrinker.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+/* Registered shrinkers. Only added at boot, so walked without lock. */
+static struct list shrinkers;
+/* Reclaim may run before the first shrinker is registered */
+static bool shrinkers_ready;
+/* One thread shrinks at a time, so freed pages are counted to it */
+static struct lock shrink_lock;
+
+/* Register SHRINKER. Should be called at boot. */
+void shrinker_register(struct shrinker *shrinker) {
+	enum intr_level old_level;
+
+	ASSERT(shrinker->count != NULL && shrinker->scan != NULL);
+
+	shrinker->deferred = 0;
+	shrinker->scan_cnt = 0;
+	shrinker->freed_cnt = 0;
+	old_level = intr_disable();
+	if (!shrinkers_ready) {
+		list_init(&shrinkers);
+		lock_init(&shrink_lock);
+		shrinkers_ready = true;
+	}
+	list_push_back(&shrinkers, &shrinker->elem);
+	intr_set_level(old_level);
+}
+
+/* Caller scanned SCANNED of TOTAL pages it reclaims from. Scan every cache
+ * in the same proportion of its freeable pages. Pressure too small to
+ * scan a page is carried over to the next call. Skipped if another thread
+ * is shrinking. Return pages given back to the kernel pool. */
+size_t shrink_caches(size_t scanned, size_t total) {
+	struct list_elem *e;
+	struct shrinker *shrinker;
+	size_t nr_pages, freed, freed_total = 0;
+
+	if (!shrinkers_ready || intr_context() || !total ||
+		!lock_try_acquire(&shrink_lock)) {
+		return 0;
+	}
+	for (e = list_begin(&shrinkers); e != list_end(&shrinkers);
+		 e = list_next(e)) {
+		shrinker = list_entry(e, struct shrinker, elem);
+		shrinker->deferred += (uint64_t)shrinker->count() * scanned;
+		nr_pages = shrinker->deferred / total;
+		if (!nr_pages) {
+			continue;
+		}
+		shrinker->deferred %= total;
+		palloc_count_begin();
+		shrinker->scan(nr_pages);
+		freed = palloc_count_end();
+		shrinker->scan_cnt++;
+		shrinker->freed_cnt += freed;
+		freed_total += freed;
+	}
+	lock_release(&shrink_lock);
+	return freed_total;
+}
+
+/* Prints what each shrinker freed. */
+void shrinker_print_stats(void) {
+	struct list_elem *e;
+	struct shrinker *shrinker;
+
+	if (!shrinkers_ready) {
+		return;
+	}
+	for (e = list_begin(&shrinkers); e != list_end(&shrinkers);
+		 e = list_next(e)) {
+		shrinker = list_entry(e, struct shrinker, elem);
+		printf("shrinker %s: %llu scans, %llu pages freed\n", shrinker->name,
+			   shrinker->scan_cnt, shrinker->freed_cnt);
+	}
+}
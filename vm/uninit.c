@@ -77,7 +77,9 @@ static void uninit_destroy(struct page *page) {
 	struct uninit_page *uninit UNUSED = &page->uninit;
 	/* TODO: Fill this function.
 	 * TODO: If you don't have anything to do, just return. */
-	if (uninit->aux) {
+	/* Aux of anonymous page is the parent page copied by fork, which is not
+	 * owned. Executable pages are not uninit, see vm_alloc_origin_page(). */
+	if (uninit->aux && VM_TYPE(uninit->type) != VM_ANON) {
 		free(uninit->aux);
 	}
 }
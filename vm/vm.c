@@ -3,33 +3,263 @@
 #include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/zswap.h"
+#include "vm/prefetch.h"
+#include "vm/shrinker.h"
 #include "threads/synch.h"
+#include <bitmap.h>
+#include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "threads/mmu.h"
 #include "userprog/process.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
 
 static struct frame *frame_table;
+/* Lock for LRU lists, text cache and swapped out sharers. Always taken
+ * before frame lock. */
 static struct lock ft_lock;
+/* Lock for memory accounting in supplemental page table */
+static struct lock acct_lock;
+bool swapd_enabled;
+bool ws_enabled;
+/* Number of current working set sample, starting from 1 */
+static uint32_t ws_epoch = 1;
+/* Wakes up writeback thread */
+static struct semaphore swapd_sema;
+bool compact_enabled;
+/* One compaction at a time */
+static struct lock compact_lock;
+size_t rss_limit_default;
 void *user_start_page;
 clock_t user_page_no;
+void *frame_start_page;
+clock_t frame_page_no;
+
+/* Active and inactive LRU lists of one kind of frame. */
+struct lru_lists {
+	struct list active;
+	struct list inactive;
+	size_t active_cnt;
+	size_t inactive_cnt;
+};
+
+/* LRU lists for anonymous frames and file backed frames, indexed by
+ * frame->is_file. Protected by ft_lock. */
+static struct lru_lists lru_lists[2];
+/* Keep inactive list at least 1/INACTIVE_RATIO of active list. */
+#define INACTIVE_RATIO 1
+/* Number of evictions so far. Page remember this value when evicted. */
+static uint64_t evict_clock = 1;
+/* Pages claimed after a fault on sequentially accessed page. */
+#define FAULT_AROUND_CNT 8
+/* MADV_WILLNEED prefaults at most WILLNEED_MAX pages, 128 KB, in the
+ * advising process. Rest of the range is left to faults. */
+#define WILLNEED_MAX 32
+/* Exec prefetch brings in at most 1/PREFETCH_RATIO of user memory. */
+#define PREFETCH_RATIO 4
+/* Exec prefetch reads up to PREFETCH_BATCH back to back pages at once. */
+#define PREFETCH_BATCH 8
+
+/* Executable bytes read at once by exec prefetch. */
+struct prefetch_batch {
+	struct inode *inode;
+	off_t ofs;
+	size_t len;
+	uint8_t *buf;
+};
+/* Failed evictions in a row before OOM killer runs */
+#define OOM_RETRY 4
+/* Working set is pages accessed in last WS_WINDOW samples, taken every
+ * WS_SAMPLE_TICKS */
+#define WS_WINDOW 4
+#define WS_SAMPLE_TICKS 25
+
+/* Shared read-only frame filled with zero. Never-written anonymous pages are
+ * mapped here on read fault. This frame is never on LRU lists and never
+ * freed. */
+static void *zero_kva;
+#define vm_on_zero_page(page) (((page)->kva) == zero_kva)
+/* Anonymous page which is never touched and has no content to load */
+#define vm_is_zero_fill(page)                                   \
+	(VM_TYPE((page)->operations->type) == VM_UNINIT &&          \
+	 VM_TYPE((page)->uninit.type) == VM_ANON &&                 \
+	 (page)->uninit.init == NULL && !(page)->is_sharing)
+
+/* Anonymous page of executable text */
+#define vm_is_text(page)                                        \
+	(VM_TYPE((page)->operations->type) == VM_ANON && anon_is_text(page))
+
+/* Latency of page faults by type, in TSC cycles. */
+static struct fault_stat fault_stat[FAULT_TYPE_CNT];
+static const char *fault_type_names[FAULT_TYPE_CNT] = {
+	"uninit", "anon", "file", "cow", "stack", "around"};
+
+static inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/* Frames holding executable text keyed by inode and content, so that every
+ * process running the same executable maps the same frames.
+ * Protected by ft_lock. */
+static struct hash text_cache;
 
-/* Get next clock index */
-#define next_clock(clock) (((clock) + 1) % user_page_no)
+/* Key of a frame in text cache. */
+struct text_entry {
+	struct inode *inode;
+	int32_t ofs;
+	uint32_t read_bytes;
+	struct frame *frame;
+	struct hash_elem text_elem;
+};
+
+/* Frame lock is IS_LOCKED of the frame instead of struct lock, which is
+ * bigger than the rest of frame. Threads waiting for a frame sleep on one of
+ * FRAME_WAITQ_CNT queues chosen by frame index. */
+#define FRAME_WAITQ_CNT 64
+static struct list frame_waitq[FRAME_WAITQ_CNT];
+
+/* Thread sleeping on frame wait queue. */
+struct frame_waiter {
+	struct thread *thread;
+	struct frame *frame;
+	struct list_elem waitq_elem;
+};
+
+/* Statistics of replacement policy. */
+static struct {
+	uint64_t evict_cnt;
+	uint64_t activate_cnt;
+	uint64_t deactivate_cnt;
+	uint64_t refault_cnt;
+	uint64_t refault_activate_cnt;
+	uint64_t zero_map_cnt;
+	uint64_t zero_break_cnt;
+	uint64_t cow_break_cnt;
+	uint64_t cow_reuse_cnt;
+	uint64_t ksm_scan_cnt;
+	uint64_t ksm_pass_cnt;
+	int64_t ksm_ticks;
+	uint64_t ksm_merge_cnt;
+	uint64_t ksm_zero_cnt;
+	uint64_t huge_map_cnt;
+	uint64_t huge_fail_cnt;
+	uint64_t text_load_cnt;
+	uint64_t text_share_cnt;
+	uint64_t text_drop_cnt;
+	uint64_t fault_around_cnt;
+	uint64_t willneed_cnt;
+	uint64_t dontneed_cnt;
+	uint64_t local_evict_cnt;
+	uint64_t evict_fail_cnt;
+	uint64_t oom_kill_cnt;
+	uint64_t swapd_pass_cnt;
+	uint64_t swapd_clean_cnt;
+	uint64_t dirty_evict_cnt;
+	uint64_t ws_pass_cnt;
+	uint64_t ws_keep_cnt;
+	uint64_t prefetch_cnt;
+	uint64_t migrate_cnt;
+	uint64_t compact_cnt;
+	uint64_t compact_fail_cnt;
+	uint64_t balance_return_cnt;
+	uint64_t balance_reserve_cnt;
+} vm_stat;
 /* Convert clock index to kernal virtual address */
-#define ctov(clock) ((void *)((user_start_page) + ((clock)*PGSIZE)))
+#define ctov(clock) ((void *)((frame_start_page) + ((clock)*PGSIZE)))
 /* Convert kernal virtual address to clock index */
-#define vtoc(kva) ((clock_t)(pg_no((kva) - (user_start_page))))
+#define vtoc(kva) ((clock_t)(pg_no((kva) - (frame_start_page))))
 /* Convert kernal virtual address to frame pointer */
 #define vtof(kva) (frame_table + (vtoc(kva)))
 /* Convert frame pointer to clock index */
-#define ftoc(frame) ((clock_t)((struct frame *)(frame) - (frame_table)))
+#define ftoc(fp) ((clock_t)((struct frame *)(fp) - (frame_table)))
 /* Convert frame pointer to kernal virtual address */
-#define ftov(frame) ((ctov(ftoc(frame))))
+#define ftov(fp) ((ctov(ftoc(fp))))
+
+#define frame_waitq_of(fp) (&frame_waitq[ftoc(fp) % FRAME_WAITQ_CNT])
+
+/* Write FLAG of FRAME. Flags share one word, see struct frame. */
+#define frame_set(frame, flag, value)                                          \
+	do {                                                                       \
+		enum intr_level old_level_ = intr_disable();                           \
+		(frame)->flag = (value);                                               \
+		intr_set_level(old_level_);                                            \
+	} while (0)
+
+/* Acquire lock of FRAME, sleeping until it is available. */
+static void frame_lock(struct frame *frame) {
+	struct frame_waiter waiter = {.thread = thread_current(), .frame = frame};
+	enum intr_level old_level;
+
+	ASSERT(!intr_context());
+
+	old_level = intr_disable();
+	while (frame->is_locked) {
+		list_push_back(frame_waitq_of(frame), &waiter.waitq_elem);
+		thread_block();
+	}
+	frame->is_locked = true;
+	intr_set_level(old_level);
+}
+
+/* Try to acquire lock of FRAME without sleeping. */
+static bool frame_trylock(struct frame *frame) {
+	enum intr_level old_level = intr_disable();
+	bool success = !frame->is_locked;
+
+	frame->is_locked = true;
+	intr_set_level(old_level);
+	return success;
+}
+
+/* Release lock of FRAME, waking up every thread waiting for it. */
+static void frame_unlock(struct frame *frame) {
+	struct list *waitq = frame_waitq_of(frame);
+	struct frame_waiter *waiter;
+	struct list_elem *e;
+	int max_priority = PRI_MIN;
+	enum intr_level old_level;
+
+	old_level = intr_disable();
+	ASSERT(frame->is_locked);
+	frame->is_locked = false;
+	for (e = list_begin(waitq); e != list_end(waitq);) {
+		waiter = list_entry(e, struct frame_waiter, waitq_elem);
+		if (waiter->frame != frame) {
+			e = list_next(e);
+			continue;
+		}
+		e = list_remove(e);
+		if (thread_priority_of(waiter->thread) > max_priority) {
+			max_priority = thread_priority_of(waiter->thread);
+		}
+		thread_unblock(waiter->thread);
+	}
+	intr_set_level(old_level);
+
+	if (max_priority > thread_priority_of(thread_current())) {
+		thread_yield();
+	}
+}
 
 static uint64_t spt_hash_func(const struct hash_elem *, void *);
 static bool spt_less_func(const struct hash_elem *,
 						  const struct hash_elem *, void *);
 static void spt_destroy_func(struct hash_elem *, void *);
+static uint64_t text_hash_func(const struct hash_elem *, void *);
+static bool text_less_func(const struct hash_elem *,
+						   const struct hash_elem *, void *);
+static void ksm_init(void);
+static void fault_print_stats(void);
+static void swapd_init(void);
+static void ws_init(void);
+static void compact_init(void);
+static void balance_init(void);
+static struct vm_file_arg *vm_file_arg_dup(const struct vm_file_arg *);
 
 static uint64_t spt_hash_func(const struct hash_elem *e, void *aux UNUSED) {
 	struct page *page = hash_entry(e, struct page, spt_elem);
@@ -56,16 +286,98 @@ void vm_init(void) {
 	register_inspect_intr();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
-	if (!(frame_table = malloc(sizeof(struct frame) * user_page_no))) {
+	if (!(frame_table = malloc(sizeof(struct frame) * frame_page_no))) {
 		PANIC("frame table init fail");
 	}
-	for (clock_t idx = 0; idx < user_page_no; ++idx) {
+	for (clock_t idx = 0; idx < frame_page_no; ++idx) {
 		frame = frame_table + idx;
+		frame->is_locked = false;
 		frame->is_claiming = false;
 		list_init(&(frame->page_list));
-		lock_init(&(frame->frame_lock));
+		frame->lru = LRU_NONE;
+		frame->text = NULL;
+	}
+	for (int idx = 0; idx < FRAME_WAITQ_CNT; ++idx) {
+		list_init(&frame_waitq[idx]);
+	}
+	for (int idx = 0; idx < 2; ++idx) {
+		list_init(&lru_lists[idx].active);
+		list_init(&lru_lists[idx].inactive);
+		lru_lists[idx].active_cnt = 0;
+		lru_lists[idx].inactive_cnt = 0;
 	}
 	lock_init(&ft_lock);
+	lock_init(&acct_lock);
+	lock_init(&compact_lock);
+	prefetch_init();
+	if (!hash_init(&text_cache, text_hash_func, text_less_func, NULL)) {
+		PANIC("text cache init fail");
+	}
+	if (!(zero_kva = palloc_get_page(PAL_USER | PAL_ZERO))) {
+		PANIC("zero page init fail");
+	}
+	if (ksm_enabled) {
+		ksm_init();
+	}
+	if (swapd_enabled) {
+		swapd_init();
+	}
+	if (ws_enabled) {
+		ws_init();
+	}
+	if (compact_enabled) {
+		compact_init();
+	}
+	if (pool_balance) {
+		balance_init();
+	}
+}
+
+/* Prints virtual memory statistics. */
+void vm_print_stats(void) {
+	printf("VM: %llu evictions, %llu activations, %llu deactivations\n",
+		   vm_stat.evict_cnt, vm_stat.activate_cnt, vm_stat.deactivate_cnt);
+	printf("VM: %llu refaults, %llu activated by refault distance\n",
+		   vm_stat.refault_cnt, vm_stat.refault_activate_cnt);
+	printf("VM: %llu zero page mappings, %llu zero page breaks\n",
+		   vm_stat.zero_map_cnt, vm_stat.zero_break_cnt);
+	printf("VM: %llu copy-on-write breaks, %llu reused by last sharer\n",
+		   vm_stat.cow_break_cnt, vm_stat.cow_reuse_cnt);
+	printf("KSM: %llu frames scanned in %llu passes, %lld ticks; "
+		   "%llu frames merged, %llu into zero page\n",
+		   vm_stat.ksm_scan_cnt, vm_stat.ksm_pass_cnt, vm_stat.ksm_ticks,
+		   vm_stat.ksm_merge_cnt, vm_stat.ksm_zero_cnt);
+	printf("VM: %llu text loads, %llu shared from text cache, "
+		   "%llu text frames dropped\n",
+		   vm_stat.text_load_cnt, vm_stat.text_share_cnt,
+		   vm_stat.text_drop_cnt);
+	printf("VM: %llu huge page mappings, %llu failed, %llu split\n",
+		   vm_stat.huge_map_cnt, vm_stat.huge_fail_cnt, huge_split_cnt);
+	printf("VM: %llu pages faulted around, %llu prefaulted and "
+		   "%llu released by madvise\n",
+		   vm_stat.fault_around_cnt, vm_stat.willneed_cnt,
+		   vm_stat.dontneed_cnt);
+	printf("VM: %llu evictions local to process over resident limit\n",
+		   vm_stat.local_evict_cnt);
+	printf("VM: %llu evictions failed for full swap, %llu OOM kills\n",
+		   vm_stat.evict_fail_cnt, vm_stat.oom_kill_cnt);
+	printf("VM: %llu frames cleaned in %llu writeback passes, "
+		   "%llu dirty frames evicted directly\n",
+		   vm_stat.swapd_clean_cnt, vm_stat.swapd_pass_cnt,
+		   vm_stat.dirty_evict_cnt);
+	printf("VM: %llu working set samples, %llu frames kept in working set\n",
+		   vm_stat.ws_pass_cnt, vm_stat.ws_keep_cnt);
+	printf("VM: %llu pages prefetched on exec\n", vm_stat.prefetch_cnt);
+	printf("VM: %llu frames migrated, %llu compactions, %llu failed\n",
+		   vm_stat.migrate_cnt, vm_stat.compact_cnt, vm_stat.compact_fail_cnt);
+	printf("VM: %llu frames returned to kernel pool, %llu freed for kernel "
+		   "reserve\n",
+		   vm_stat.balance_return_cnt, vm_stat.balance_reserve_cnt);
+	fault_print_stats();
+	anon_print_stats();
+	zswap_print_stats();
+	prefetch_print_stats();
+	shrinker_print_stats();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -84,7 +396,8 @@ enum vm_type page_get_type(struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim(void);
 static bool vm_do_claim_page(struct page *page);
-static struct frame *vm_evict_frame(void);
+static bool vm_share_text_page(struct page *page);
+static struct frame *vm_evict_frame(struct frame *victim);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -124,6 +437,7 @@ bool vm_alloc_page_with_initializer(enum vm_type type, void *upage,
 			break;
 		};
 		page->pml4 = thread_current()->pml4;
+		page->spt = spt;
 		page->writable = writable;
 		page->is_sharing = false;
 		circular_init(&page->page_elem);
@@ -167,66 +481,394 @@ void spt_remove_page(struct supplemental_page_table *spt, struct page *page) {
 	spt_destroy_func(&page->spt_elem, NULL);
 }
 
-/* Get the struct frame, that will be evicted. */
-static struct frame *vm_get_victim(void) {
-	struct frame *victim;
-	/* TODO: The policy for eviction is up to you. */
-	static clock_t before_clock = 0;
-	clock_t current_clock;
+/* Charge RSS resident pages and SWAP swapped pages to owner of PAGE. */
+static void vm_acct(struct page *page, int rss, int swap) {
+	struct supplemental_page_table *spt = page->spt;
+
+	lock_acquire(&acct_lock);
+	spt->rss += rss;
+	spt->swap_cnt += swap;
+	if (spt->rss > spt->rss_peak) {
+		spt->rss_peak = spt->rss;
+	}
+	lock_release(&acct_lock);
+}
+
+/* Charge DELTA swapped pages to owner of PAGE. */
+void vm_acct_swap(struct page *page, int delta) { vm_acct(page, 0, delta); }
+
+/* Set resident page limit of current process to LIMIT, 0 for unlimited.
+ * Return the previous limit. */
+size_t vm_set_rss_limit(size_t limit) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	size_t old_limit = spt->rss_limit;
+
+	spt->rss_limit = limit;
+	return old_limit;
+}
+
+/* Set OOM adjustment of current process to ADJ, clamped to OOM_ADJ_MIN
+ * and OOM_ADJ_MAX. Return the previous adjustment. */
+int vm_set_oom_adj(int adj) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	int old_adj = spt->oom_adj;
+
+	if (adj < OOM_ADJ_MIN) {
+		adj = OOM_ADJ_MIN;
+	} else if (adj > OOM_ADJ_MAX) {
+		adj = OOM_ADJ_MAX;
+	}
+	spt->oom_adj = adj;
+	return old_adj;
+}
+
+/* Return memory pressure, percent of swap slots in use. OOM killer runs
+ * when it reaches 100 and nothing else can be evicted. */
+int vm_mem_pressure(void) {
+	size_t total, used = anon_swap_usage(&total);
+
+	return total ? used * 100 / total : 100;
+}
+
+/* Prints memory usage of process NAME owning SPT, if it is limited, and
+ * its working set if it is sampled. */
+void spt_print_acct(struct supplemental_page_table *spt, const char *name) {
+	if (ws_enabled) {
+		printf("%s: working set %zu pages (peak %zu)\n", name, spt->ws_size,
+			   spt->ws_peak);
+	}
+	if (!spt->rss_limit) {
+		return;
+	}
+	printf("%s: rss %zu pages (peak %zu, limit %zu), swap %zu pages, "
+		   "%llu limit hits\n",
+		   name, spt->rss, spt->rss_peak, spt->rss_limit, spt->swap_cnt,
+		   spt->limit_hit_cnt);
+}
+
+static uint64_t text_hash_func(const struct hash_elem *e, void *aux UNUSED) {
+	struct text_entry *entry = hash_entry(e, struct text_entry, text_elem);
+	uint64_t key[3] = {(uint64_t)entry->inode, entry->ofs,
+					   entry->read_bytes};
+	return hash_bytes(key, sizeof key);
+}
+
+static bool text_less_func(const struct hash_elem *a,
+						   const struct hash_elem *b, void *aux UNUSED) {
+	struct text_entry *entry_a = hash_entry(a, struct text_entry, text_elem);
+	struct text_entry *entry_b = hash_entry(b, struct text_entry, text_elem);
+	if (entry_a->inode != entry_b->inode) {
+		return entry_a->inode < entry_b->inode;
+	}
+	if (entry_a->ofs != entry_b->ofs) {
+		return entry_a->ofs < entry_b->ofs;
+	}
+	return entry_a->read_bytes < entry_b->read_bytes;
+}
+
+/* Find frame in text cache holding content of ORIGIN.
+ * Need ft_lock before call this */
+static struct frame *text_cache_find(struct vm_file_arg *origin) {
+	struct text_entry key;
+	struct hash_elem *e;
+
+	key.inode = file_get_inode(origin->file);
+	key.ofs = origin->ofs;
+	key.read_bytes = origin->read_bytes;
+	e = hash_find(&text_cache, &key.text_elem);
+	return e ? hash_entry(e, struct text_entry, text_elem)->frame : NULL;
+}
+
+/* Put FRAME holding text PAGE in text cache, unless other frame holds the
+ * same content already. Need ft_lock before call this */
+static void text_cache_insert(struct frame *frame, struct page *page) {
+	struct vm_file_arg *origin = page->anon.origin;
+	struct text_entry *entry = malloc(sizeof(struct text_entry));
+
+	if (!entry) {
+		return;
+	}
+	entry->inode = file_get_inode(origin->file);
+	entry->ofs = origin->ofs;
+	entry->read_bytes = origin->read_bytes;
+	entry->frame = frame;
+	if (hash_insert(&text_cache, &entry->text_elem)) {
+		free(entry);
+		return;
+	}
+	frame->text = entry;
+}
+
+/* Take FRAME out of text cache. Need ft_lock before call this */
+static void text_cache_remove(struct frame *frame) {
+	if (frame->text) {
+		hash_delete(&text_cache, &frame->text->text_elem);
+		free(frame->text);
+		frame->text = NULL;
+	}
+}
+
+/* Test and clear accessed bit of every page mapped on FRAME.
+ * Return true if any of them was accessed. */
+static bool frame_test_and_clear_accessed(struct frame *frame) {
 	struct page *page;
 	struct list_elem *page_elem;
-	bool is_acessed;
-	uint64_t *pml4;
+	bool is_accessed = false;
 
-	lock_acquire(&ft_lock);
-	current_clock = next_clock(before_clock);
-	for (current_clock = next_clock(before_clock);
-		 current_clock != before_clock;
-		 current_clock = next_clock(current_clock)) {
-		victim = frame_table + current_clock;
-		lock_acquire(&victim->frame_lock);
-		if (victim->is_claiming) {
-			lock_release(&victim->frame_lock);
-			continue;
+	for (page_elem = list_begin(&frame->page_list);
+		 page_elem != list_end(&frame->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (pml4_is_accessed(page->pml4, page->va)) {
+			pml4_set_accessed(page->pml4, page->va, false);
+			is_accessed = true;
+		}
+		if (page->accessed) {
+			page->accessed = false;
+			is_accessed = true;
+		}
+	}
+	return is_accessed;
+}
+
+/* Return true if a page on FRAME was accessed in the last WS_WINDOW
+ * samples. Need frame_lock before call this */
+static bool frame_in_ws(struct frame *frame) {
+	struct page *page;
+	struct list_elem *page_elem;
+
+	for (page_elem = list_begin(&frame->page_list);
+		 page_elem != list_end(&frame->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (page->ws_stamp && ws_epoch - page->ws_stamp < WS_WINDOW) {
+			return true;
 		}
+	}
+	return false;
+}
+
+/* Return access pattern of initialized PAGE. File page without its own
+ * advice follows the advice given to the file. */
+static int vm_page_advice(struct page *page) {
+	if (page->advice == MADV_NORMAL &&
+		VM_TYPE(page->operations->type) == VM_FILE && page->file.file) {
+		return inode_get_advice(file_get_inode(page->file.file),
+								page->file.ofs);
+	}
+	return page->advice;
+}
 
-		is_acessed = false;
-		for (page_elem = list_begin(&victim->page_list);
-			 page_elem != list_end(&victim->page_list);
-			 page_elem = list_next(page_elem)) {
-			page = list_entry(page_elem, struct page, page_elem);
-			pml4 = page->pml4;
+/* Return true if FRAME holds sequentially accessed page, which is used once
+ * and gets no second chance on reclaim. Need frame_lock before call this */
+static bool frame_is_streaming(struct frame *frame) {
+	struct page *page;
 
-			if (pml4_is_accessed(pml4, page->va)) {
-				pml4_set_accessed(pml4, page->va, false);
-				is_acessed = true;
-			}
+	if (list_empty(&frame->page_list)) {
+		return false;
+	}
+	page = list_entry(list_front(&frame->page_list), struct page, page_elem);
+	return vm_page_advice(page) == MADV_SEQUENTIAL;
+}
+
+/* Put FRAME on LRU list of STATE. Need ft_lock before call this */
+static void lru_insert(struct frame *frame, enum frame_lru state) {
+	struct lru_lists *lists = &lru_lists[frame->is_file];
+
+	ASSERT(lock_held_by_current_thread(&ft_lock));
+	ASSERT(frame->lru == LRU_NONE);
+
+	if (state == LRU_ACTIVE) {
+		list_push_front(&lists->active, &frame->lru_elem);
+		lists->active_cnt++;
+	} else {
+		list_push_front(&lists->inactive, &frame->lru_elem);
+		lists->inactive_cnt++;
+	}
+	frame_set(frame, lru, state);
+	frame_set(frame, referenced, false);
+}
+
+/* Take FRAME off its LRU list. Need ft_lock before call this */
+static void lru_remove(struct frame *frame) {
+	struct lru_lists *lists = &lru_lists[frame->is_file];
+
+	ASSERT(lock_held_by_current_thread(&ft_lock));
+
+	if (frame->lru == LRU_NONE) {
+		return;
+	}
+	list_remove(&frame->lru_elem);
+	if (frame->lru == LRU_ACTIVE) {
+		lists->active_cnt--;
+	} else {
+		lists->inactive_cnt--;
+	}
+	frame_set(frame, lru, LRU_NONE);
+}
+
+/* Add freshly claimed FRAME holding PAGE to LRU lists.
+ * New frames start on inactive list so that a single streaming scan can not
+ * flush the working set. A page that refaults within the size of active list
+ * would have been kept if inactive list was that larger, so it goes straight
+ * to active list. */
+static void lru_add(struct frame *frame, struct page *page) {
+	struct lru_lists *lists;
+	enum frame_lru state = LRU_INACTIVE;
+	uint64_t distance;
+
+	lock_acquire(&ft_lock);
+	frame_set(frame, is_file, page_get_type(page) == VM_FILE);
+	lists = &lru_lists[frame->is_file];
+	if (page->evict_stamp) {
+		distance = evict_clock - page->evict_stamp;
+		page->evict_stamp = 0;
+		vm_stat.refault_cnt++;
+		/* Sequential page is used once, random page is unlikely to be
+		 * used again soon */
+		if (distance <= lists->active_cnt &&
+			vm_page_advice(page) == MADV_NORMAL) {
+			vm_stat.refault_activate_cnt++;
+			state = LRU_ACTIVE;
 		}
-		if (!is_acessed) {
-			goto get_victim_done;
+	}
+	lru_insert(frame, state);
+	lock_release(&ft_lock);
+}
+
+/* Move frames from tail of active list of LISTS to inactive list until
+ * inactive list is large enough. Accessed frames get another round on
+ * active list. Need ft_lock before call this */
+static void lru_age_active(struct lru_lists *lists) {
+	struct frame *frame;
+	size_t scan = lists->active_cnt;
+
+	while (scan-- > 0 && lists->inactive_cnt * INACTIVE_RATIO <
+							 lists->active_cnt) {
+		frame = list_entry(list_back(&lists->active), struct frame, lru_elem);
+		frame_lock(frame);
+		lru_remove(frame);
+		if (!frame->is_claiming && frame_test_and_clear_accessed(frame) &&
+			!frame_is_streaming(frame)) {
+			lru_insert(frame, LRU_ACTIVE);
+		} else {
+			lru_insert(frame, LRU_INACTIVE);
+			vm_stat.deactivate_cnt++;
 		}
-		lock_release(&victim->frame_lock);
+		frame_unlock(frame);
 	}
+}
+
+/* Choose which LRU lists to reclaim from. File and anonymous frames age
+ * separately; reclaim from the one which has larger inactive list, and
+ * prefer file frames on tie since they are cheaper to drop.
+ * Need ft_lock before call this */
+static struct lru_lists *lru_choose_lists(void) {
+	struct lru_lists *anon = &lru_lists[false];
+	struct lru_lists *file = &lru_lists[true];
+
+	if (file->active_cnt + file->inactive_cnt == 0) {
+		return anon;
+	}
+	if (anon->active_cnt + anon->inactive_cnt == 0) {
+		return file;
+	}
+	return file->inactive_cnt >= anon->inactive_cnt ? file : anon;
+}
+
+/* Get the struct frame, that will be evicted. Return NULL if swap is full
+ * and every frame needs a swap slot to be evicted. With writeback thread,
+ * a frame which needs a write is taken only when no clean one is found. */
+static struct frame *vm_get_victim(void) {
+	struct frame *victim, *dirty_victim;
+	struct lru_lists *lists;
+	size_t scan, total;
+	bool force, swap_full, is_claiming;
 
-	// If every frame is accessed and first frame is evicting
-	lock_acquire(&victim->frame_lock);
-	if (victim->is_claiming) {
-		lock_release(&victim->frame_lock);
-		while (true) {
-			current_clock = next_clock(current_clock);
-			victim = frame_table + current_clock;
-			lock_acquire(&victim->frame_lock);
-			if (!victim->is_claiming) {
+	lock_acquire(&ft_lock);
+	for (force = false;; force = true) {
+		swap_full = anon_swap_usage(&total) == total;
+		lists = lru_choose_lists();
+		/* Anonymous frames have nowhere to go */
+		if (swap_full &&
+			lru_lists[true].active_cnt + lru_lists[true].inactive_cnt) {
+			lists = &lru_lists[true];
+		}
+		lru_age_active(lists);
+		/* Second pass ignores accessed bits of active list */
+		if (force && list_empty(&lists->inactive)) {
+			lists = lists == &lru_lists[true] ? &lru_lists[false]
+											  : &lru_lists[true];
+		}
+		is_claiming = false;
+		dirty_victim = NULL;
+		for (scan = lists->inactive_cnt; scan > 0; --scan) {
+			victim = list_entry(list_back(&lists->inactive), struct frame,
+								lru_elem);
+			frame_lock(victim);
+			lru_remove(victim);
+			if (victim->is_claiming) {
+				lru_insert(victim, LRU_INACTIVE);
+				is_claiming = true;
+			} else if (swap_full && !list_empty(&victim->page_list) &&
+					   anon_needs_slot(&victim->page_list)) {
+				lru_insert(victim, LRU_INACTIVE);
+			} else if (frame_test_and_clear_accessed(victim) && !force &&
+					   !frame_is_streaming(victim)) {
+				/* Accessed twice while inactive goes to active list */
+				if (victim->referenced) {
+					lru_insert(victim, LRU_ACTIVE);
+					vm_stat.activate_cnt++;
+				} else {
+					lru_insert(victim, LRU_INACTIVE);
+					frame_set(victim, referenced, true);
+				}
+			} else if (ws_enabled && !force && !frame_is_streaming(victim) &&
+					   frame_in_ws(victim)) {
+				/* WSClock, page of a working set is kept while others */
+				lru_insert(victim, LRU_INACTIVE);
+				vm_stat.ws_keep_cnt++;
+			} else if (swapd_enabled && !force &&
+					   !list_empty(&victim->page_list) &&
+					   anon_needs_slot(&victim->page_list)) {
+				/* Left to writeback thread while clean one is found */
+				lru_insert(victim, LRU_INACTIVE);
+				if (!dirty_victim) {
+					dirty_victim = victim;
+				}
+			} else {
+				goto get_victim_done;
+			}
+			frame_unlock(victim);
+		}
+		if (dirty_victim) {
+			sema_up(&swapd_sema);
+			victim = dirty_victim;
+			frame_lock(victim);
+			if (!victim->is_claiming && victim->lru == LRU_INACTIVE) {
+				lru_remove(victim);
+				vm_stat.dirty_evict_cnt++;
 				goto get_victim_done;
 			}
-			lock_release(&victim->frame_lock);
+			frame_unlock(victim);
+		}
+		if (force) {
+			/* Nothing can be evicted without swap slot */
+			if (swap_full && !is_claiming) {
+				lock_release(&ft_lock);
+				return NULL;
+			}
+			/* Every frame is claiming now. Wait for someone done. */
+			lock_release(&ft_lock);
+			thread_yield();
+			lock_acquire(&ft_lock);
 		}
 	}
 get_victim_done:
-	victim->is_claiming = true;
-	lock_release(&victim->frame_lock);
-
-	before_clock = current_clock;
+	frame_set(victim, is_claiming, true);
+	frame_unlock(victim);
+	evict_clock++;
+	vm_stat.evict_cnt++;
 	lock_release(&ft_lock);
 
 	ASSERT(victim->is_claiming == true);
@@ -234,68 +876,271 @@ get_victim_done:
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
-static struct frame *vm_evict_frame(void) {
+/* Get a frame mapped only by the current process, which is over its
+ * resident limit. Oldest frames go first, and accessed ones get a second
+ * chance. Return NULL if the process has no such frame. */
+static struct frame *vm_get_local_victim(void) {
+	/* Oldest lists first */
+	struct list *lists[] = {
+		&lru_lists[true].inactive, &lru_lists[false].inactive,
+		&lru_lists[true].active, &lru_lists[false].active};
+	uint64_t *pml4 = thread_current()->pml4;
 	struct frame *victim;
+	struct page *page;
+	struct list_elem *e;
+	bool force;
+
+	lock_acquire(&ft_lock);
+	for (int pass = 0; pass < 2; ++pass) {
+		force = pass > 0;
+		for (size_t idx = 0; idx < sizeof lists / sizeof *lists; ++idx) {
+			for (e = list_rbegin(lists[idx]); e != list_rend(lists[idx]);
+				 e = list_prev(e)) {
+				victim = list_entry(e, struct frame, lru_elem);
+				frame_lock(victim);
+				if (!victim->is_claiming &&
+					!list_empty(&victim->page_list) &&
+					list_front(&victim->page_list) ==
+						list_back(&victim->page_list)) {
+					page = list_entry(list_front(&victim->page_list),
+									  struct page, page_elem);
+					if (page->pml4 == pml4 &&
+						(!frame_test_and_clear_accessed(victim) || force)) {
+						goto get_local_victim_done;
+					}
+				}
+				frame_unlock(victim);
+			}
+		}
+	}
+	lock_release(&ft_lock);
+	return NULL;
+get_local_victim_done:
+	lru_remove(victim);
+	frame_set(victim, is_claiming, true);
+	frame_unlock(victim);
+	evict_clock++;
+	vm_stat.evict_cnt++;
+	vm_stat.local_evict_cnt++;
+	lock_release(&ft_lock);
+	return victim;
+}
+
+/* Evict pages on VICTIM, which is chosen by vm_get_victim or
+ * vm_get_local_victim, and return it. Return NULL if VICTIM is NULL or
+ * swap is full, then VICTIM is left as it was. */
+static struct frame *vm_evict_frame(struct frame *victim) {
 	struct page *page;
 	struct list_elem *page_elem;
 	uint64_t *pml4;
 
-	victim = vm_get_victim();
-
-	ASSERT(victim != NULL);
+	if (!victim) {
+		return NULL;
+	}
 
-	lock_acquire(&victim->frame_lock);
+	frame_lock(victim);
 	if (list_empty(&victim->page_list)) {
 		goto evict_done;
 	}
+	/* Split 2 MB mappings first, so no sharer is left half evicted */
+	for (page_elem = list_begin(&victim->page_list);
+		 page_elem != list_end(&victim->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (!pml4_split_page(page->pml4, page->va)) {
+			goto evict_fail;
+		}
+	}
+	/* Frame shared by forked processes is written once, to one swap slot
+	 * referred by every sharer */
+	if (list_front(&victim->page_list) != list_back(&victim->page_list)) {
+		if (!anon_swap_out_shared(&victim->page_list)) {
+			goto evict_fail;
+		}
+	}
 	for (page_elem = list_begin(&victim->page_list);
 		 page_elem != list_end(&victim->page_list);
 		 page_elem = list_next(page_elem)) {
 		page = list_entry(page_elem, struct page, page_elem);
 		pml4 = page->pml4;
-		if (!swap_out(page)) {
-			ASSERT("swap out error");
+		if (vm_on_phymem(page) && !swap_out(page)) {
+			/* Only sole page is swapped out here, nothing is evicted */
+			ASSERT(page_elem == list_begin(&victim->page_list));
+			goto evict_fail;
 		}
+		page->evict_stamp = evict_clock;
+		vm_acct(page, -1, 0);
 
 		ASSERT(pml4_get_page(pml4, page->va) != NULL);
 
 		pml4_clear_page(pml4, page->va);
 	}
-	// set as circular list
-	circular_make(&victim->page_list);
+	/* Keep lock order. VICTIM is still claiming, so it is not evicted or
+	 * claimed by others while unlocked. */
+	frame_unlock(victim);
+	lock_acquire(&ft_lock);
+	frame_lock(victim);
+	text_cache_remove(victim);
+	/* Every sharer may be freed by its owner while unlocked */
+	if (!list_empty(&victim->page_list)) {
+		page = list_entry(list_front(&victim->page_list), struct page,
+						  page_elem);
+		if (vm_is_text(page)) {
+			/* Dropped text comes back through text cache one by one */
+			while (!list_empty(&victim->page_list)) {
+				circular_init(list_pop_front(&victim->page_list));
+			}
+			vm_stat.text_drop_cnt++;
+		} else {
+			// set as circular list
+			circular_make(&victim->page_list);
+		}
+	}
+	lock_release(&ft_lock);
 
 	ASSERT(list_empty(&victim->page_list));
 evict_done:
-	lock_release(&victim->frame_lock);
+	frame_unlock(victim);
 
 	ASSERT(victim->is_claiming == true);
 
 	return victim;
+evict_fail:
+	/* Swap is full or out of page tables, put VICTIM back in working set */
+	frame_unlock(victim);
+	lock_acquire(&ft_lock);
+	frame_lock(victim);
+	/* Freed by its owner while unlocked */
+	if (!list_empty(&victim->page_list)) {
+		lru_insert(victim, LRU_ACTIVE);
+		frame_set(victim, is_claiming, false);
+	}
+	frame_unlock(victim);
+	vm_stat.evict_fail_cnt++;
+	lock_release(&ft_lock);
+	return NULL;
+}
+
+/* OOM killer state, protected by acct_lock. */
+static int oom_pending; /* Killed processes not exited yet */
+
+/* Process with the highest OOM score so far. */
+struct oom_victim {
+	struct thread *thread;
+	int score;
+	size_t total; /* User frames and swap slots */
+};
+
+/* Remember thread T in AUX, struct oom_victim, if it is a user process
+ * with higher OOM score. Score is memory usage in per mille of user frames
+ * and swap slots, plus its OOM adjustment. */
+static void oom_select(struct thread *t, void *aux) {
+	struct oom_victim *victim = aux;
+	struct supplemental_page_table *spt = &t->spt;
+	int score;
+
+	if (t->pml4 == NULL || spt->oom_killed || spt->oom_adj == OOM_ADJ_MIN) {
+		return;
+	}
+	score = (spt->rss + spt->swap_cnt) * 1000 / victim->total + spt->oom_adj;
+	if (!victim->thread || score > victim->score) {
+		victim->thread = t;
+		victim->score = score;
+	}
+}
+
+/* Kill the process of the highest OOM score. It exits before it returns to
+ * user mode, and is woken up if it sleeps killable. Wait for the previous
+ * one to exit first. */
+static void vm_oom_kill(void) {
+	struct oom_victim victim = {.thread = NULL};
+	char name[16];
+	size_t total;
+	enum intr_level old_level;
+
+	anon_swap_usage(&total);
+	victim.total = user_page_no + total;
+
+	lock_acquire(&acct_lock);
+	if (oom_pending) {
+		lock_release(&acct_lock);
+		return;
+	}
+	/* Marked under interrupts off, so victim can not be gone before it */
+	old_level = intr_disable();
+	thread_foreach(oom_select, &victim);
+	if (victim.thread) {
+		victim.thread->spt.oom_killed = true;
+		thread_kill(victim.thread);
+		strlcpy(name, victim.thread->name, sizeof name);
+	}
+	intr_set_level(old_level);
+	if (victim.thread) {
+		oom_pending++;
+		vm_stat.oom_kill_cnt++;
+	}
+	lock_release(&acct_lock);
+
+	if (victim.thread) {
+		printf("Out of memory: kill process %s, score %d\n", name,
+			   victim.score);
+	}
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
-/* Need ft_lock before call this */
-static struct frame *vm_get_frame(void) {
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space. When swap is full
+ * too, OOM killer frees memory and NULL is returned if the current process
+ * is the one killed. */
+static struct frame *vm_alloc_frame(void) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
 	struct frame *frame;
 	void *kva;
 	clock_t new_clock;
+	int fail_cnt = 0;
 	/* TODO: Fill this function. */
-	lock_acquire(&ft_lock);
-	kva = palloc_get_page(PAL_USER);
-	if (kva) {
-		new_clock = vtoc(kva);
-		frame = frame_table + new_clock;
-		frame->is_claiming = true;
-		lock_release(&ft_lock);
-		ASSERT(ftov(frame) == kva);
-	} else {
+	/* Process over its limit pays with its own pages first */
+	if (spt->rss_limit && spt->rss >= spt->rss_limit) {
+		lock_acquire(&acct_lock);
+		spt->limit_hit_cnt++;
+		lock_release(&acct_lock);
+		if ((frame = vm_evict_frame(vm_get_local_victim()))) {
+			return frame;
+		}
+	}
+	for (;;) {
+		lock_acquire(&ft_lock);
+		kva = palloc_get_page(PAL_USER);
+		if (kva) {
+			new_clock = vtoc(kva);
+			frame = frame_table + new_clock;
+			frame_set(frame, is_claiming, true);
+			lock_release(&ft_lock);
+			ASSERT(ftov(frame) == kva);
+			break;
+		}
 		lock_release(&ft_lock);
-		frame = vm_evict_frame();
+		if (swapd_enabled) {
+			sema_up(&swapd_sema);
+		}
+		/* Kernel caches shrink along with user frames. With -balance, kernel
+		 * pages freed are lent to user allocation. Unlocked read of LRU
+		 * sizes. */
+		shrink_caches(1, lru_lists[false].active_cnt +
+							 lru_lists[false].inactive_cnt +
+							 lru_lists[true].active_cnt +
+							 lru_lists[true].inactive_cnt);
+		if ((frame = vm_evict_frame(vm_get_victim()))) {
+			break;
+		}
+		/* Swap is full. Retry while others free, then kill someone */
+		if (++fail_cnt % OOM_RETRY == 0) {
+			vm_oom_kill();
+		}
+		if (spt->oom_killed) {
+			return NULL;
+		}
+		thread_yield();
 	}
 
 	ASSERT(frame != NULL);
@@ -304,6 +1149,110 @@ static struct frame *vm_get_frame(void) {
 	return frame;
 }
 
+/* vm_alloc_frame, and charge the time to the fault being handled. */
+static struct frame *vm_get_frame(void) {
+	struct fault_clock *clock = thread_current()->spt.fault_clock;
+	uint64_t start = rdtsc();
+	struct frame *frame = vm_alloc_frame();
+
+	if (clock) {
+		clock->frame += rdtsc() - start;
+	}
+	return frame;
+}
+
+/* Load PAGE into KVA, and charge the time to the fault being handled. */
+static bool vm_swap_in(struct page *page, void *kva) {
+	struct fault_clock *clock = thread_current()->spt.fault_clock;
+	uint64_t start = rdtsc();
+	bool success = swap_in(page, kva);
+
+	if (clock) {
+		clock->io += rdtsc() - start;
+	}
+	return success;
+}
+
+/* Start timing a fault of current thread with CLOCK. */
+static void fault_begin(struct fault_clock *clock) {
+	clock->start = rdtsc();
+	clock->frame = 0;
+	clock->io = 0;
+	thread_current()->spt.fault_clock = clock;
+}
+
+/* Return histogram bucket of CYCLES. */
+static size_t fault_bucket(uint64_t cycles) {
+	size_t bucket = 0;
+
+	for (cycles >>= FAULT_HIST_SHIFT; cycles > 1 && bucket + 1 < FAULT_HIST_CNT;
+		 cycles >>= 1) {
+		bucket++;
+	}
+	return bucket;
+}
+
+/* Stop timing the fault of CLOCK, and count it as TYPE. */
+static void fault_end(struct fault_clock *clock, enum fault_type type) {
+	struct fault_stat *stat = &fault_stat[type];
+
+	thread_current()->spt.fault_clock = NULL;
+	stat->cnt++;
+	stat->cycles += rdtsc() - clock->start;
+	stat->frame_cycles += clock->frame;
+	stat->io_cycles += clock->io;
+	stat->frame_hist[fault_bucket(clock->frame)]++;
+	stat->io_hist[fault_bucket(clock->io)]++;
+}
+
+/* Return fault type of not present PAGE. */
+static enum fault_type fault_type_of(struct page *page) {
+	switch (VM_TYPE(page->operations->type)) {
+	case VM_UNINIT:
+		return FAULT_UNINIT;
+	case VM_FILE:
+		return FAULT_FILE;
+	default:
+		return FAULT_ANON;
+	}
+}
+
+/* Copy fault statistics of every type into STATS, and clear them if RESET.
+ * Return the number of types. */
+int vm_get_fault_stat(struct fault_stat *stats, bool reset) {
+	memcpy(stats, fault_stat, sizeof fault_stat);
+	if (reset) {
+		memset(fault_stat, 0, sizeof fault_stat);
+	}
+	return FAULT_TYPE_CNT;
+}
+
+/* Prints fault latency statistics. Histogram bucket N counts faults that
+ * spent less than 2^(N + 1 + FAULT_HIST_SHIFT) cycles. */
+static void fault_print_stats(void) {
+	struct fault_stat *stat;
+
+	for (int type = 0; type < FAULT_TYPE_CNT; ++type) {
+		stat = &fault_stat[type];
+		if (!stat->cnt) {
+			continue;
+		}
+		printf("Fault %s: %llu faults, %llu cycles avg, %llu in frame, "
+			   "%llu in I/O\n",
+			   fault_type_names[type], stat->cnt, stat->cycles / stat->cnt,
+			   stat->frame_cycles / stat->cnt, stat->io_cycles / stat->cnt);
+		printf("Fault %s: frame", fault_type_names[type]);
+		for (int idx = 0; idx < FAULT_HIST_CNT; ++idx) {
+			printf(" %llu", stat->frame_hist[idx]);
+		}
+		printf(", I/O");
+		for (int idx = 0; idx < FAULT_HIST_CNT; ++idx) {
+			printf(" %llu", stat->io_hist[idx]);
+		}
+		printf("\n");
+	}
+}
+
 /* Growing the stack. */
 static void vm_stack_growth(void *addr) {
 	struct supplemental_page_table *spt = &thread_current()->spt;
@@ -316,63 +1265,1231 @@ static void vm_stack_growth(void *addr) {
 	}
 }
 
-/* Handle the fault on write_protected page */
-static bool vm_handle_wp(struct page *page) {
-	struct frame *frame;
+/* Map never-written anonymous PAGE to the shared zero frame as read-only.
+ * The page is transmuted to anonymous page without allocating a frame. */
+static bool vm_map_zero_page(struct page *page) {
+	struct frame *frame = vtof(zero_kva);
 
-	if (!page->writable) {
+	ASSERT(vm_is_zero_fill(page));
+	ASSERT(circular_is_alone(&page->page_elem));
+
+	page->kva = zero_kva;
+	if (!anon_initializer(page, VM_ANON, zero_kva)) {
+		page->kva = NULL;
 		return false;
 	}
+	page->is_sharing = true;
+	frame_lock(frame);
+	list_push_back(&frame->page_list, &page->page_elem);
+	frame_unlock(frame);
 
-	ASSERT(page->is_sharing);
-
-	frame = vtof(page->kva);
-	page->is_sharing = false;
-	if (!circular_is_alone(&page->page_elem)) {
-		lock_acquire(&frame->frame_lock);
-		list_remove(&page->page_elem);
-		lock_release(&frame->frame_lock);
-
-		swap_out(page);
-
-		pml4_clear_page(page->pml4, page->va);
-		circular_init(&page->page_elem);
-		return vm_do_claim_page(page);
-	} else {
-		pml4_set_writable(page->pml4, page->va, true);
-		return true;
+	if (!pml4_set_page(page->pml4, page->va, zero_kva, false)) {
+		PANIC("I don't wan to write cod about pml4 fail");
 	}
+	vm_stat.zero_map_cnt++;
+	return true;
 }
 
-/* Return true on success */
-bool vm_try_handle_fault(struct intr_frame *f, void *addr,
-						 bool user, bool write,
-						 bool not_present) {
-	struct supplemental_page_table *spt = &thread_current()->spt;
-	struct page *page;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
-	if (user && is_kernel_vaddr(addr)) {
-		return false;
+/* Mark FRAME as claiming so that it is not evicted while using it.
+ * Wait until whoever claiming FRAME is done. */
+static void frame_pin(struct frame *frame) {
+	frame_lock(frame);
+	while (frame->is_claiming) {
+		frame_unlock(frame);
+		thread_yield();
+		frame_lock(frame);
+	}
+	frame_set(frame, is_claiming, true);
+	frame_unlock(frame);
+}
+
+/* Release FRAME marked by frame_pin or vm_get_frame. */
+static void frame_unpin(struct frame *frame) {
+	frame_lock(frame);
+	frame_set(frame, is_claiming, false);
+	frame_unlock(frame);
+}
+
+/* Compaction.
+ * Huge page needs an aligned run of HPGCNT free user frames. When there is
+ * none, anonymous frames in the aligned block with fewest frames in use are
+ * moved to free frames elsewhere, remapping every sharer through its page
+ * list. The background thread keeps one run free with -compact. */
+
+/* Ticks between background compaction passes */
+#define COMPACT_SLEEP_TICKS 100
+
+/* Move pages on anonymous frame SRC to free frame at DST_KVA. Return false
+ * if SRC is busy, file backed or mapped by a huge page. */
+static bool compact_migrate(struct frame *src, void *dst_kva) {
+	struct frame *dst = vtof(dst_kva);
+	struct list_elem *page_elem;
+	struct page *page;
+	uint64_t *pte;
+	bool writable, dirty, accessed, moved = false;
+	enum intr_level old_level;
+
+	lock_acquire(&ft_lock);
+	if (!frame_trylock(src)) {
+		lock_release(&ft_lock);
+		return false;
+	}
+	if (src->is_claiming || src->lru == LRU_NONE || src->is_file ||
+		list_empty(&src->page_list)) {
+		goto migrate_done;
+	}
+	/* Every sharer should be mapped by 4 KB page */
+	for (page_elem = list_begin(&src->page_list);
+		 page_elem != list_end(&src->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		pte = pml4e_walk(page->pml4, (uint64_t)page->va, 0);
+		if (!pte || !(*pte & PTE_P) || (*pte & PTE_PS) ||
+			page->kva != ftov(src)) {
+			goto migrate_done;
+		}
+	}
+
+	frame_lock(dst);
+	/* No user code runs between copy and remap */
+	old_level = intr_disable();
+	memcpy(dst_kva, ftov(src), PGSIZE);
+	while (!list_empty(&src->page_list)) {
+		page = list_entry(list_pop_front(&src->page_list), struct page,
+						  page_elem);
+		writable = pml4_is_writable(page->pml4, page->va);
+		dirty = pml4_is_dirty(page->pml4, page->va);
+		accessed = pml4_is_accessed(page->pml4, page->va);
+		pml4_clear_page(page->pml4, page->va);
+		page->kva = dst_kva;
+		if (!pml4_set_page(page->pml4, page->va, dst_kva, writable)) {
+			PANIC("I don't wan to write cod about pml4 fail");
+		}
+		pml4_set_dirty(page->pml4, page->va, dirty);
+		pml4_set_accessed(page->pml4, page->va, accessed);
+		list_push_back(&dst->page_list, &page->page_elem);
+	}
+	intr_set_level(old_level);
+
+	/* DST takes the place of SRC on LRU list and text cache */
+	list_insert(&src->lru_elem, &dst->lru_elem);
+	list_remove(&src->lru_elem);
+	frame_set(dst, lru, src->lru);
+	frame_set(src, lru, LRU_NONE);
+	frame_set(dst, is_file, false);
+	frame_set(dst, referenced, src->referenced);
+	frame_set(dst, is_claiming, false);
+	dst->text = src->text;
+	if (dst->text) {
+		dst->text->frame = dst;
+		src->text = NULL;
+	}
+	frame_unlock(dst);
+	moved = true;
+	vm_stat.migrate_cnt++;
+migrate_done:
+	frame_unlock(src);
+	lock_release(&ft_lock);
+	return moved;
+}
+
+/* Return true if FRAME is in use and compaction can not move it: pinned
+ * or being claimed, file backed, the zero frame, or a user page borrowed
+ * by kernel allocation. Unlocked peek, compact_migrate checks again under
+ * lock. */
+static bool frame_is_unmovable(struct frame *frame) {
+	if (frame->lru != LRU_NONE) {
+		return frame->is_file;
+	}
+	return frame->is_claiming || ftov(frame) == zero_kva ||
+		   !list_empty(&frame->page_list) ||
+		   !palloc_page_is_free(ftov(frame));
+}
+
+/* Return aligned block of HPGCNT user frames with fewest frames in use,
+ * whose frames in use all look movable. Higher block wins a tie, as palloc
+ * fills lower frames first. Return NULL if there is no such block. */
+static void *compact_pick(void) {
+	clock_t start = vtoc(user_start_page) +
+					(HPGCNT - pg_no(user_start_page) % HPGCNT) % HPGCNT;
+	clock_t end = vtoc(user_start_page) + user_page_no;
+	clock_t idx;
+	struct frame *frame;
+	size_t used, best_used = HPGCNT;
+	void *best = NULL;
+
+	lock_acquire(&ft_lock);
+	for (; start + HPGCNT <= end; start += HPGCNT) {
+		used = 0;
+		for (idx = start; idx < start + HPGCNT; ++idx) {
+			frame = frame_table + idx;
+			if (frame_is_unmovable(frame)) {
+				break;
+			}
+			if (frame->lru != LRU_NONE) {
+				used++;
+			}
+		}
+		if (idx == start + HPGCNT && used <= best_used) {
+			best = ctov(start);
+			best_used = used;
+		}
+	}
+	lock_release(&ft_lock);
+	return best;
+}
+
+/* Make an aligned run of HPGCNT free user frames and allocate it.
+ * Return NULL if no block can be emptied. */
+static void *vm_compact(void) {
+	struct bitmap *held;
+	void *start, *kva, *dst_kva;
+	size_t idx;
+
+	if (!(held = bitmap_create(HPGCNT))) {
+		return NULL;
+	}
+	lock_acquire(&compact_lock);
+	if (!(start = compact_pick())) {
+		goto compact_fail;
+	}
+	/* Take free frames of the block first, so that frames moved out are
+	 * not moved into the block again */
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		if (palloc_get_page_at(start + idx * PGSIZE)) {
+			bitmap_mark(held, idx);
+		}
+	}
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		kva = start + idx * PGSIZE;
+		if (bitmap_test(held, idx) || palloc_get_page_at(kva)) {
+			bitmap_mark(held, idx);
+			continue;
+		}
+		if (!(dst_kva = palloc_get_page(PAL_USER))) {
+			goto compact_fail;
+		}
+		if (!compact_migrate(vtof(kva), dst_kva)) {
+			palloc_free_page(dst_kva);
+			goto compact_fail;
+		}
+		/* Frame moved out is left allocated to us */
+		bitmap_mark(held, idx);
+	}
+	vm_stat.compact_cnt++;
+	lock_release(&compact_lock);
+	bitmap_destroy(held);
+	return start;
+compact_fail:
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		if (bitmap_test(held, idx)) {
+			palloc_free_page(start + idx * PGSIZE);
+		}
+	}
+	vm_stat.compact_fail_cnt++;
+	lock_release(&compact_lock);
+	bitmap_destroy(held);
+	return NULL;
+}
+
+/* Body of the compaction thread. Empty a block when no run is free. */
+static void compact_thread(void *aux UNUSED) {
+	void *kva;
+
+	for (;;) {
+		timer_sleep(COMPACT_SLEEP_TICKS);
+		if ((kva = palloc_get_aligned(PAL_USER, HPGCNT, HPGCNT)) ||
+			(kva = vm_compact())) {
+			palloc_free_multiple(kva, HPGCNT);
+		}
+	}
+}
+
+/* Start the compaction thread. */
+static void compact_init(void) {
+	if (thread_create("kcompactd", PRI_MIN, compact_thread, NULL) ==
+		TID_ERROR) {
+		PANIC("compaction thread create fail");
+	}
+}
+
+/* Pool balancer.
+ * With -balance, palloc lends free kernel pages to user allocation and
+ * borrows free user pages for kernel allocation. When kernel pool runs
+ * short, this thread evicts user frames lent by kernel pool, shrinks
+ * kernel caches if that was not enough, then keeps free user pages
+ * reserved for kernel allocation. */
+
+/* Set up by balance_init, and set when the thread has work to do */
+static bool balance_ready;
+static bool balance_pending;
+static struct semaphore balance_sema;
+
+/* Wake up the balancer thread. Called by palloc, when kernel pool is
+ * running short. */
+void vm_balance_wake(void) {
+	if (balance_ready && !balance_pending) {
+		balance_pending = true;
+		sema_up(&balance_sema);
+	}
+}
+
+/* Take FRAME off LRU lists for eviction, as vm_get_victim does.
+ * Return false if FRAME is busy, free or can not be evicted. */
+static bool balance_isolate(struct frame *frame) {
+	size_t total;
+	bool swap_full, isolated = false;
+
+	lock_acquire(&ft_lock);
+	if (frame->lru == LRU_NONE || !frame_trylock(frame)) {
+		lock_release(&ft_lock);
+		return false;
+	}
+	swap_full = anon_swap_usage(&total) == total;
+	if (!frame->is_claiming && frame->lru != LRU_NONE &&
+		!list_empty(&frame->page_list) &&
+		!(swap_full && anon_needs_slot(&frame->page_list))) {
+		lru_remove(frame);
+		frame_set(frame, is_claiming, true);
+		evict_clock++;
+		vm_stat.evict_cnt++;
+		isolated = true;
+	}
+	frame_unlock(frame);
+	lock_release(&ft_lock);
+	return isolated;
+}
+
+/* Evict VICTIM taken by vm_get_victim or balance_isolate and give it
+ * back to its pool. */
+static bool balance_free(struct frame *victim) {
+	struct frame *frame = vm_evict_frame(victim);
+
+	if (!frame) {
+		return false;
+	}
+	frame_lock(frame);
+	frame_set(frame, is_claiming, false);
+	frame_unlock(frame);
+	palloc_free_page(ftov(frame));
+	return true;
+}
+
+/* Body of the balancer thread. */
+static void balance_thread(void *aux UNUSED) {
+	clock_t lent_end = vtoc(user_start_page);
+	clock_t idx;
+
+	for (;;) {
+		sema_down(&balance_sema);
+		balance_pending = false;
+		/* Frames in kernel pool go back first */
+		for (idx = 0; idx < lent_end && palloc_kernel_shortage(); ++idx) {
+			if (balance_isolate(frame_table + idx) &&
+				balance_free(frame_table + idx)) {
+				vm_stat.balance_return_cnt++;
+			}
+		}
+		/* Then caches, by the part of lent frames scanned */
+		if (palloc_kernel_shortage()) {
+			shrink_caches(idx, lent_end);
+		}
+		while (palloc_reserve_shortage() && balance_free(vm_get_victim())) {
+			vm_stat.balance_reserve_cnt++;
+		}
+	}
+}
+
+/* Start the balancer thread. */
+static void balance_init(void) {
+	sema_init(&balance_sema, 0);
+	if (thread_create("balanced", PRI_DEFAULT, balance_thread, NULL) ==
+		TID_ERROR) {
+		PANIC("balancer thread create fail");
+	}
+	balance_ready = true;
+}
+
+bool huge_enabled;
+
+/* Back the 2 MB aligned region around zero-fill PAGE with physically
+ * contiguous frames mapped by a single huge page, when every page in the
+ * region is untouched zero-fill anonymous page of same permission.
+ * Pages and frames are still managed one by one, only the mapping is huge;
+ * mmu splits it when any page of it is unmapped or write protected.
+ * Return false if the region is not eligible or no aligned frames are free. */
+static bool vm_map_huge_page(struct page *page) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	void *start = hpg_round_down(page->va);
+	struct page *cur;
+	struct frame *frame;
+	void *kva;
+	size_t idx;
+
+	ASSERT(vm_is_zero_fill(page));
+
+	if (spt->rss_limit && spt->rss + HPGCNT > spt->rss_limit) {
+		return false;
+	}
+	/* Some page of the region was mapped once */
+	if (pml4e_walk(page->pml4, (uint64_t)start, 0)) {
+		return false;
+	}
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		cur = spt_find_page(spt, start + idx * PGSIZE);
+		if (!cur || !vm_is_zero_fill(cur) || cur->writable != page->writable) {
+			return false;
+		}
+	}
+
+	lock_acquire(&ft_lock);
+	kva = palloc_get_aligned(PAL_USER, HPGCNT, HPGCNT);
+	lock_release(&ft_lock);
+	/* Move frames out of the way for a free run */
+	if (!kva && !(kva = vm_compact())) {
+		vm_stat.huge_fail_cnt++;
+		return false;
+	}
+	lock_acquire(&ft_lock);
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		frame_set(vtof(kva + idx * PGSIZE), is_claiming, true);
+	}
+	lock_release(&ft_lock);
+
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		cur = spt_find_page(spt, start + idx * PGSIZE);
+		frame = vtof(kva + idx * PGSIZE);
+		if (!vm_swap_in(cur, ftov(frame))) {
+			PANIC("I don't wan to handdle swap in fail");
+		}
+		frame_lock(frame);
+		list_push_back(&frame->page_list, &cur->page_elem);
+		frame_unlock(frame);
+		lru_add(frame, cur);
+		vm_acct(cur, 1, 0);
+	}
+	if (!pml4_set_huge_page(page->pml4, start, kva, page->writable)) {
+		/* Fall back to 4 KB mappings of the same frames */
+		for (idx = 0; idx < HPGCNT; ++idx) {
+			if (!pml4_set_page(page->pml4, start + idx * PGSIZE,
+							   kva + idx * PGSIZE, page->writable)) {
+				PANIC("I don't wan to write cod about pml4 fail");
+			}
+		}
+	} else {
+		vm_stat.huge_map_cnt++;
+	}
+	for (idx = 0; idx < HPGCNT; ++idx) {
+		frame_unpin(vtof(kva + idx * PGSIZE));
+	}
+	return true;
+}
+
+/* Break copy-on-write of shared PAGE on first write. Copy the shared frame
+ * into a new frame and remap only PAGE, without any disk I/O. */
+static bool vm_break_cow(struct page *page) {
+	void *old_kva = page->kva;
+	struct frame *old_frame = vtof(old_kva);
+	struct frame *frame;
+	bool is_zero = vm_on_zero_page(page);
+
+	/* Only PAGE is remapped, so 2 MB mapping is split first */
+	if (!pml4_split_page(page->pml4, page->va)) {
+		return false;
+	}
+	/* Zero frame is never evicted */
+	if (!is_zero) {
+		frame_pin(old_frame);
+		/* Evicted while waiting. Fault again to swap in */
+		if (page->kva != old_kva) {
+			frame_unpin(old_frame);
+			return true;
+		}
+	}
+
+	if (!(frame = vm_get_frame())) {
+		if (!is_zero) {
+			frame_unpin(old_frame);
+		}
+		return false;
+	}
+	if (is_zero) {
+		memset(ftov(frame), 0, PGSIZE);
+	} else {
+		memcpy(ftov(frame), old_kva, PGSIZE);
+	}
+
+	frame_lock(old_frame);
+	list_remove(&page->page_elem);
+	frame_unlock(old_frame);
+	anon_check_dirty(page);
+	if (!is_zero) {
+		frame_unpin(old_frame);
+	}
+
+	pml4_clear_page(page->pml4, page->va);
+	page->is_sharing = false;
+	page->kva = ftov(frame);
+	if (!pml4_set_page(page->pml4, page->va, page->kva, vm_writable(page))) {
+		PANIC("I don't wan to write cod about pml4 fail");
+	}
+	frame_lock(frame);
+	list_push_back(&frame->page_list, &page->page_elem);
+	frame_unlock(frame);
+	lru_add(frame, page);
+	frame_unpin(frame);
+
+	if (is_zero) {
+		vm_acct(page, 1, 0);
+		vm_stat.zero_break_cnt++;
+	} else {
+		vm_stat.cow_break_cnt++;
+	}
+	return true;
+}
+
+/* Handle the fault on write_protected page */
+static bool vm_handle_wp(struct page *page) {
+	struct frame *frame;
+	bool is_sole;
+
+	if (!page->writable) {
+		return false;
+	}
+
+	ASSERT(page->is_sharing);
+
+	if (vm_on_zero_page(page)) {
+		return vm_break_cow(page);
+	}
+
+	/* Other sharers already broke away, so take over the frame */
+	frame = vtof(page->kva);
+	frame_lock(frame);
+	/* Merged into other frame while waiting. Fault again */
+	if (page->kva != ftov(frame)) {
+		frame_unlock(frame);
+		return true;
+	}
+	is_sole = list_front(&frame->page_list) == list_back(&frame->page_list);
+	if (is_sole) {
+		if (!pml4_set_writable(page->pml4, page->va, true)) {
+			frame_unlock(frame);
+			return false;
+		}
+		page->is_sharing = false;
+		vm_stat.cow_reuse_cnt++;
+	}
+	frame_unlock(frame);
+
+	return is_sole || vm_break_cow(page);
+}
+
+/* Writeback thread.
+ * Woken up by direct reclaim, it writes cold dirty anonymous frames at the
+ * tail of inactive list to swap, leaving them mapped as swap cache. Then
+ * eviction drops them without waiting for the disk. */
+
+/* Frames written per wake up, and inactive frames looked at for them */
+#define SWAPD_BATCH 16
+#define SWAPD_SCAN 64
+
+/* Pin up to SWAPD_BATCH frames needing a write from the tail of inactive
+ * anonymous list into BATCH. Return the number of them. */
+static size_t swapd_collect(struct frame **batch) {
+	struct list *inactive = &lru_lists[false].inactive;
+	struct list_elem *e, *prev;
+	struct frame *frame;
+	size_t cnt = 0, scan = 0;
+
+	lock_acquire(&ft_lock);
+	for (e = list_rbegin(inactive);
+		 e != list_rend(inactive) && cnt < SWAPD_BATCH && scan < SWAPD_SCAN;
+		 e = prev, ++scan) {
+		prev = list_prev(e);
+		frame = list_entry(e, struct frame, lru_elem);
+		frame_lock(frame);
+		/* Only sole page, sharers are written once at eviction */
+		if (!frame->is_claiming && !list_empty(&frame->page_list) &&
+			list_front(&frame->page_list) == list_back(&frame->page_list) &&
+			anon_needs_slot(&frame->page_list)) {
+			lru_remove(frame);
+			frame_set(frame, is_claiming, true);
+			batch[cnt++] = frame;
+		}
+		frame_unlock(frame);
+	}
+	lock_release(&ft_lock);
+	return cnt;
+}
+
+/* Write back frames in BATCH of CNT, and put them back at the tail of
+ * inactive list so that they are evicted first. */
+static void swapd_write(struct frame **batch, size_t cnt) {
+	struct lru_lists *lists = &lru_lists[false];
+	struct frame *frame;
+	struct page *page;
+
+	for (size_t idx = 0; idx < cnt; ++idx) {
+		frame = batch[idx];
+		frame_lock(frame);
+		if (!list_empty(&frame->page_list)) {
+			page = list_entry(list_front(&frame->page_list), struct page,
+							  page_elem);
+			if (anon_writeback(page)) {
+				vm_stat.swapd_clean_cnt++;
+			}
+		}
+		frame_unlock(frame);
+
+		lock_acquire(&ft_lock);
+		frame_lock(frame);
+		/* Freed by its owner while unlocked */
+		if (!list_empty(&frame->page_list)) {
+			lru_insert(frame, LRU_INACTIVE);
+			list_remove(&frame->lru_elem);
+			list_push_back(&lists->inactive, &frame->lru_elem);
+			frame_set(frame, is_claiming, false);
+		}
+		frame_unlock(frame);
+		lock_release(&ft_lock);
+	}
+}
+
+static void swapd_thread(void *aux UNUSED) {
+	struct frame *batch[SWAPD_BATCH];
+	size_t cnt;
+
+	for (;;) {
+		sema_down(&swapd_sema);
+		/* Wake ups while writing are served by this pass */
+		while (sema_try_down(&swapd_sema))
+			;
+		cnt = swapd_collect(batch);
+		swapd_write(batch, cnt);
+		vm_stat.swapd_pass_cnt++;
+	}
+}
+
+/* Start the writeback thread. */
+static void swapd_init(void) {
+	sema_init(&swapd_sema, 0);
+	if (thread_create("swapd", PRI_DEFAULT, swapd_thread, NULL) ==
+		TID_ERROR) {
+		PANIC("swapd thread create fail");
+	}
+}
+
+/* Working set sampler.
+ * A background thread moves accessed bits of every resident page into its
+ * sample stamp every WS_SAMPLE_TICKS, and counts pages of each process
+ * accessed in the last WS_WINDOW samples as its working set. */
+
+/* Sample accessed bits of pages on FRAME. */
+static void ws_sample_frame(struct frame *frame) {
+	struct page *page;
+	struct list_elem *page_elem;
+
+	/* Skip frame busy for a while, it is sampled next time */
+	if (!frame_trylock(frame)) {
+		return;
+	}
+	for (page_elem = list_begin(&frame->page_list);
+		 page_elem != list_end(&frame->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (pml4_is_accessed(page->pml4, page->va)) {
+			pml4_set_accessed(page->pml4, page->va, false);
+			page->accessed = true;
+			page->ws_stamp = ws_epoch;
+		}
+		if (page->ws_stamp && ws_epoch - page->ws_stamp < WS_WINDOW) {
+			page->spt->ws_scan++;
+		}
+	}
+	frame_unlock(frame);
+}
+
+/* Publish working set counted in this pass for thread T. */
+static void ws_publish(struct thread *t, void *aux UNUSED) {
+	struct supplemental_page_table *spt = &t->spt;
+
+	spt->ws_size = spt->ws_scan;
+	spt->ws_scan = 0;
+	if (spt->ws_size > spt->ws_peak) {
+		spt->ws_peak = spt->ws_size;
+	}
+}
+
+static void ws_thread(void *aux UNUSED) {
+	struct frame *zero_frame = vtof(zero_kva);
+	enum intr_level old_level;
+
+	for (;;) {
+		timer_sleep(WS_SAMPLE_TICKS);
+		for (clock_t idx = 0; idx < frame_page_no; ++idx) {
+			if (frame_table + idx != zero_frame) {
+				ws_sample_frame(frame_table + idx);
+			}
+		}
+		old_level = intr_disable();
+		thread_foreach(ws_publish, NULL);
+		intr_set_level(old_level);
+		ws_epoch++;
+		vm_stat.ws_pass_cnt++;
+	}
+}
+
+/* Start the working set sampler. */
+static void ws_init(void) {
+	if (thread_create("wsd", PRI_DEFAULT, ws_thread, NULL) == TID_ERROR) {
+		PANIC("wsd thread create fail");
+	}
+}
+
+/* Kernel same-page merging.
+ * A background thread walks the frame table, remembering checksum of every
+ * anonymous frame. Frame whose checksum did not change since the last visit
+ * is looked up among frames of the same checksum seen in this pass, and
+ * merged into it as a read-only shared frame when contents really match.
+ * Merged pages are broken by the usual copy-on-write path. */
+
+/* Frames checksummed per wake up and ticks to sleep between them */
+#define KSM_BATCH 64
+#define KSM_SLEEP_TICKS 10
+
+/* Frame seen in current pass, indexed by clock index. */
+struct ksm_node {
+	uint64_t checksum;
+	bool in_table;
+	struct hash_elem ksm_elem;
+};
+
+bool ksm_enabled;
+static struct ksm_node *ksm_nodes;
+/* Nodes of current pass keyed by checksum. Used only by ksm thread. */
+static struct hash ksm_table;
+static uint64_t zero_checksum;
+
+static uint64_t ksm_hash_func(const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry(e, struct ksm_node, ksm_elem)->checksum;
+}
+
+static bool ksm_less_func(const struct hash_elem *a, const struct hash_elem *b,
+						  void *aux UNUSED) {
+	return hash_entry(a, struct ksm_node, ksm_elem)->checksum <
+		   hash_entry(b, struct ksm_node, ksm_elem)->checksum;
+}
+
+static void ksm_clear_func(struct hash_elem *e, void *aux UNUSED) {
+	hash_entry(e, struct ksm_node, ksm_elem)->in_table = false;
+}
+
+/* Return true if every page on FRAME is anonymous and FRAME is settled.
+ * Need frame_lock of FRAME before call this */
+static bool ksm_mergeable(struct frame *frame) {
+	struct list_elem *page_elem;
+	struct page *page;
+
+	if (frame->is_claiming || frame->lru == LRU_NONE || frame->is_file ||
+		list_empty(&frame->page_list)) {
+		return false;
+	}
+	for (page_elem = list_begin(&frame->page_list);
+		 page_elem != list_end(&frame->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (VM_TYPE(page->operations->type) != VM_ANON || anon_is_text(page) ||
+			page->is_shmem) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Write protect every page on FRAME so that its content stays stable.
+ * Return false if 2 MB mapping of a page could not be split.
+ * Need frame_lock of FRAME before call this */
+static bool ksm_protect(struct frame *frame) {
+	struct list_elem *page_elem;
+	struct page *page;
+
+	for (page_elem = list_begin(&frame->page_list);
+		 page_elem != list_end(&frame->page_list);
+		 page_elem = list_next(page_elem)) {
+		page = list_entry(page_elem, struct page, page_elem);
+		if (!pml4_set_writable(page->pml4, page->va, false)) {
+			return false;
+		}
+		page->is_sharing = true;
+	}
+	return true;
+}
+
+/* Give write permission back to FRAME protected by ksm_protect, when its
+ * content changed before merge. Frame shared by forked processes stays
+ * copy-on-write. Need frame_lock of FRAME before call this */
+static void ksm_unprotect(struct frame *frame) {
+	struct page *page;
+
+	if (list_front(&frame->page_list) != list_back(&frame->page_list)) {
+		return;
+	}
+	page = list_entry(list_front(&frame->page_list), struct page, page_elem);
+	page->is_sharing = false;
+	pml4_set_writable(page->pml4, page->va, vm_writable(page));
+}
+
+/* Merge pages on SRC into DST if both have same content, and free SRC.
+ * DST may be the zero frame. Frames busy with someone else are skipped
+ * rather than waited for, so ft_lock is never held while blocking on
+ * frame_lock. */
+static bool ksm_merge(struct frame *dst, struct frame *src) {
+	bool is_zero = ftov(dst) == zero_kva;
+	struct page *page;
+	bool merged = false;
+
+	lock_acquire(&ft_lock);
+	if (!frame_trylock(dst)) {
+		lock_release(&ft_lock);
+		return false;
+	}
+	if (!frame_trylock(src)) {
+		frame_unlock(dst);
+		lock_release(&ft_lock);
+		return false;
+	}
+	if (!ksm_mergeable(src) || (!is_zero && !ksm_mergeable(dst))) {
+		goto merge_done;
+	}
+	/* Compare first, so frames that differ are not write protected */
+	if (memcmp(ftov(dst), ftov(src), PGSIZE)) {
+		goto merge_done;
+	}
+	/* Writer faults and waits for frame_lock from here */
+	if (!ksm_protect(src) || (!is_zero && !ksm_protect(dst))) {
+		goto merge_undo;
+	}
+	/* Written before protected */
+	if (memcmp(ftov(dst), ftov(src), PGSIZE)) {
+		goto merge_undo;
+	}
+	while (!list_empty(&src->page_list)) {
+		page = list_entry(list_pop_front(&src->page_list), struct page,
+						  page_elem);
+		anon_check_dirty(page);
+		pml4_clear_page(page->pml4, page->va);
+		page->kva = ftov(dst);
+		if (!pml4_set_page(page->pml4, page->va, page->kva, false)) {
+			PANIC("I don't wan to write cod about pml4 fail");
+		}
+		list_push_back(&dst->page_list, &page->page_elem);
+		if (is_zero) {
+			vm_acct(page, -1, 0);
+		}
+	}
+	lru_remove(src);
+	palloc_free_page(ftov(src));
+	merged = true;
+	vm_stat.ksm_merge_cnt++;
+	if (is_zero) {
+		vm_stat.ksm_zero_cnt++;
+	}
+	goto merge_done;
+merge_undo:
+	ksm_unprotect(src);
+	if (!is_zero) {
+		ksm_unprotect(dst);
+	}
+merge_done:
+	frame_unlock(src);
+	frame_unlock(dst);
+	lock_release(&ft_lock);
+	return merged;
+}
+
+/* Checksum frame of clock index IDX and merge it with a frame of same
+ * checksum if it is stable since the last pass. */
+static void ksm_scan_frame(clock_t idx) {
+	struct frame *frame = frame_table + idx;
+	struct ksm_node *node = ksm_nodes + idx, *other;
+	struct hash_elem *found;
+	uint64_t checksum;
+
+	/* Unlocked peek, ksm_merge checks again under lock */
+	if (frame->lru == LRU_NONE || frame->is_file || frame->is_claiming) {
+		return;
+	}
+	checksum = hash_bytes(ftov(frame), PGSIZE);
+	vm_stat.ksm_scan_cnt++;
+	if (node->in_table) {
+		hash_delete(&ksm_table, &node->ksm_elem);
+		node->in_table = false;
+	}
+	/* Volatile frame is not worth write protecting */
+	if (checksum != node->checksum) {
+		node->checksum = checksum;
+		return;
+	}
+	if (checksum == zero_checksum && ksm_merge(vtof(zero_kva), frame)) {
+		return;
+	}
+	found = hash_insert(&ksm_table, &node->ksm_elem);
+	if (!found) {
+		node->in_table = true;
+		return;
+	}
+	other = hash_entry(found, struct ksm_node, ksm_elem);
+	if (!ksm_merge(frame_table + (other - ksm_nodes), frame)) {
+		/* Keep the newer one as merge target */
+		hash_replace(&ksm_table, &node->ksm_elem);
+		other->in_table = false;
+		node->in_table = true;
+	}
+}
+
+/* Body of the merging thread. */
+static void ksm_thread(void *aux UNUSED) {
+	clock_t cursor = 0, cnt;
+	int64_t start;
+
+	for (;;) {
+		timer_sleep(KSM_SLEEP_TICKS);
+		start = timer_ticks();
+		for (cnt = 0; cnt < KSM_BATCH; ++cnt) {
+			ksm_scan_frame(cursor);
+			if (++cursor == frame_page_no) {
+				cursor = 0;
+				hash_clear(&ksm_table, ksm_clear_func);
+				vm_stat.ksm_pass_cnt++;
+			}
+		}
+		vm_stat.ksm_ticks += timer_ticks() - start;
+	}
+}
+
+/* Start the merging thread. */
+static void ksm_init(void) {
+	if (!(ksm_nodes = calloc(frame_page_no, sizeof(struct ksm_node))) ||
+		!hash_init(&ksm_table, ksm_hash_func, ksm_less_func, NULL)) {
+		PANIC("ksm init fail");
+	}
+	zero_checksum = hash_bytes(zero_kva, PGSIZE);
+	if (thread_create("ksmd", PRI_MIN, ksm_thread, NULL) == TID_ERROR) {
+		PANIC("ksm thread create fail");
+	}
+}
+
+/* Claim pages following sequentially accessed PAGE before they fault.
+ * Stop at the first hole, untouched anonymous page is left to zero page. */
+static void vm_fault_around(struct page *page) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct page *next;
+	void *va = page->va;
+
+	for (int cnt = 0; cnt < FAULT_AROUND_CNT; ++cnt) {
+		va += PGSIZE;
+		if (is_kernel_vaddr(va) || !(next = spt_find_page(spt, va))) {
+			return;
+		}
+		if (vm_on_phymem(next) || vm_is_zero_fill(next)) {
+			continue;
+		}
+		if (!vm_do_claim_page(next)) {
+			return;
+		}
+		vm_stat.fault_around_cnt++;
+	}
+}
+
+/* Save pages recorded in SPT as fault trace of its executable, and stop
+ * recording. */
+static void vm_trace_finish(struct supplemental_page_table *spt) {
+	if (!spt->trace_va) {
+		return;
+	}
+	if (spt->trace_cnt) {
+		prefetch_store(spt->trace_inumber, spt->trace_va, spt->trace_cnt);
+	}
+	free(spt->trace_va);
+	spt->trace_va = NULL;
+	spt->trace_cnt = 0;
+}
+
+/* Record fault on executable page at VA, until trace is full. */
+static void vm_trace_fault(struct supplemental_page_table *spt, void *va) {
+	spt->trace_va[spt->trace_cnt++] = va;
+	if (spt->trace_cnt == PREFETCH_TRACE_LEN) {
+		vm_trace_finish(spt);
+	}
+}
+
+/* Return the page at VA if exec prefetch should read it from executable
+ * INODE: still same as the executable, and not in text cache. */
+static struct page *prefetch_page(struct supplemental_page_table *spt,
+								  void *va, struct inode *inode) {
+	struct page *page = spt_find_page(spt, va);
+	bool is_cached = false;
+
+	if (!page || !anon_in_origin(page) ||
+		file_get_inode(page->anon.origin->file) != inode) {
+		return NULL;
+	}
+	if (vm_is_text(page)) {
+		lock_acquire(&ft_lock);
+		is_cached = text_cache_find(page->anon.origin) != NULL;
+		lock_release(&ft_lock);
+	}
+	return is_cached ? NULL : page;
+}
+
+/* Return number of pages from VA of CNT addresses, PREFETCH_BATCH at most,
+ * that are consecutive in memory and back to back in the executable of
+ * BATCH. Set byte range of BATCH to them. */
+static size_t prefetch_run(struct supplemental_page_table *spt, void **va,
+						   size_t cnt, struct prefetch_batch *batch) {
+	struct vm_file_arg *origin;
+	struct page *page;
+	size_t n;
+
+	batch->len = 0;
+	for (n = 0; n < cnt && n < PREFETCH_BATCH; ++n) {
+		if (!(page = prefetch_page(spt, va[n], batch->inode))) {
+			break;
+		}
+		origin = page->anon.origin;
+		if (n == 0) {
+			batch->ofs = origin->ofs;
+		} else if (va[n] != va[n - 1] + PGSIZE ||
+				   batch->len != n * PGSIZE ||
+				   origin->ofs != batch->ofs + (off_t)batch->len) {
+			break;
+		}
+		batch->len += origin->read_bytes;
+	}
+	return n;
+}
+
+/* Copy content of ORIGIN into KVA if exec prefetch of current process has
+ * read it already. */
+bool vm_prefetch_copy(const struct vm_file_arg *origin, void *kva) {
+	struct prefetch_batch *batch = thread_current()->spt.prefetch_batch;
+
+	if (!batch || file_get_inode(origin->file) != batch->inode ||
+		origin->ofs < batch->ofs ||
+		origin->ofs + origin->read_bytes > batch->ofs + batch->len) {
+		return false;
+	}
+	memcpy(kva, batch->buf + (origin->ofs - batch->ofs), origin->read_bytes);
+	return true;
+}
+
+/* Claim pages of executable FILE just loaded by current process, in the
+ * order of recorded fault trace. Pages back to back in the file are read
+ * by one file read. If there is no trace, or the trace is due to be
+ * recorded again, start recording one. Pages no longer same as the
+ * executable are skipped, trace may be of old file on the same sector. */
+void vm_exec_prefetch(struct file *file) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	disk_sector_t inumber = inode_get_inumber(file_get_inode(file));
+	size_t prefetch_left = user_page_no / PREFETCH_RATIO;
+	struct prefetch_batch batch = {.inode = file_get_inode(file)};
+	struct page *page;
+	void **trace_va;
+	size_t cnt, run;
+
+	if (!prefetch_enabled ||
+		!(trace_va = malloc(PREFETCH_TRACE_LEN * sizeof *trace_va))) {
+		return;
+	}
+	cnt = prefetch_lookup(inumber, trace_va);
+	if (!cnt) {
+		spt->trace_va = trace_va;
+		spt->trace_cnt = 0;
+		spt->trace_inumber = inumber;
+		return;
+	}
+	/* Pages are read one by one without the buffer */
+	batch.buf = palloc_get_multiple(0, PREFETCH_BATCH);
+	for (size_t idx = 0; idx < cnt && prefetch_left; idx += run ? run : 1) {
+		run = prefetch_run(spt, trace_va + idx, cnt - idx, &batch);
+		if (run > 1 && batch.buf &&
+			file_read_at(file, batch.buf, batch.len, batch.ofs) ==
+				(off_t)batch.len) {
+			spt->prefetch_batch = &batch;
+		}
+		for (size_t i = 0; i < run && prefetch_left; ++i) {
+			page = spt_find_page(spt, trace_va[idx + i]);
+			if (!vm_do_claim_page(page)) {
+				prefetch_left = 0;
+				break;
+			}
+			prefetch_left--;
+			vm_stat.prefetch_cnt++;
+		}
+		spt->prefetch_batch = NULL;
+	}
+	palloc_free_multiple(batch.buf, PREFETCH_BATCH);
+	free(trace_va);
+}
+
+/* Return true on success */
+bool vm_try_handle_fault(struct intr_frame *f, void *addr,
+						 bool user, bool write,
+						 bool not_present) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct page *page;
+	struct fault_clock clock;
+	enum fault_type type;
+	bool success, claimed = false, traced;
+	/* TODO: Validate the fault */
+	/* TODO: Your code goes here */
+	if (user && is_kernel_vaddr(addr)) {
+		return false;
+	}
+	/* Chosen by OOM killer */
+	if (spt->oom_killed) {
+		return false;
 	}
 	page = spt_find_page(spt, pg_round_down(addr));
 	if (page == NULL) {
 		if (f->rsp - 8 <= (uintptr_t)addr) {
+			fault_begin(&clock);
 			vm_stack_growth(addr);
+			fault_end(&clock, FAULT_STACK);
 			return true;
 		}
 		return false;
 	}
 	if (not_present) {
-		return vm_do_claim_page(page);
+		type = fault_type_of(page);
+		traced = spt->trace_va && anon_in_origin(page);
+		fault_begin(&clock);
+		if (huge_enabled && vm_is_zero_fill(page) && vm_map_huge_page(page)) {
+			success = true;
+		} else if (!write && vm_is_zero_fill(page)) {
+			success = vm_map_zero_page(page);
+		} else {
+			success = claimed = vm_do_claim_page(page);
+		}
+		fault_end(&clock, type);
+		if (claimed && traced) {
+			vm_trace_fault(spt, page->va);
+		}
+		if (claimed && vm_page_advice(page) == MADV_SEQUENTIAL) {
+			fault_begin(&clock);
+			vm_fault_around(page);
+			fault_end(&clock, FAULT_AROUND);
+		}
+		return success;
 	}
 	if (write && !vm_writable(page)) {
-		return vm_handle_wp(page);
+		fault_begin(&clock);
+		success = vm_handle_wp(page);
+		fault_end(&clock, FAULT_COW);
+		return success;
 	}
 	/* Only when check valid address in system call */
 	return true;
 }
 
+/* Drop the frame or swap slot of anonymous PAGE. It becomes untouched page,
+ * or page still same as the executable if it has one. */
+static void vm_release_page(struct page *page) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct vm_file_arg *origin = NULL;
+	void *va = page->va;
+	bool writable = page->writable;
+	uint8_t advice = page->advice;
+
+	if (page->anon.origin &&
+		!(origin = vm_file_arg_dup(page->anon.origin))) {
+		exit_with_exit_status(-1);
+	}
+	spt_remove_page(spt, page);
+	if (origin ? !vm_alloc_origin_page(va, writable, origin)
+			   : !vm_alloc_page(VM_ANON, va, writable)) {
+		exit_with_exit_status(-1);
+	}
+	spt_find_page(spt, va)->advice = advice;
+	vm_stat.dontneed_cnt++;
+}
+
+/* Return file of file-backed PAGE and set OFS to offset of PAGE in it.
+ * Return NULL for other pages. */
+static struct file *vm_page_file(struct page *page, off_t *ofs) {
+	struct vm_file_arg *arg;
+
+	if (page_get_type(page) != VM_FILE) {
+		return NULL;
+	}
+	if (VM_TYPE(page->operations->type) == VM_UNINIT) {
+		arg = page->uninit.aux;
+		*ofs = arg->ofs;
+		return arg->file;
+	}
+	*ofs = page->file.ofs;
+	return page->file.file;
+}
+
+/* Apply ADVICE on LENGTH bytes from ADDR. Every page in the range should
+ * be allocated. Return 0 on success, -1 on error. */
+int do_madvise(void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct page *page;
+	size_t page_count = pg_no(pg_round_up(length));
+	size_t willneed_left = WILLNEED_MAX;
+	struct file *file;
+	off_t ofs;
+	void *va;
+
+	if (pg_ofs(addr) || advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+		return -1;
+	}
+	for (size_t idx = 0; idx < page_count; ++idx) {
+		va = addr + idx * PGSIZE;
+		if (is_kernel_vaddr(va) || !spt_find_page(spt, va)) {
+			return -1;
+		}
+	}
+	for (size_t idx = 0; idx < page_count; ++idx) {
+		page = spt_find_page(spt, addr + idx * PGSIZE);
+		switch (advice) {
+		case MADV_WILLNEED:
+			if (willneed_left && !vm_on_phymem(page) &&
+				!vm_is_zero_fill(page)) {
+				if (!vm_do_claim_page(page)) {
+					return -1;
+				}
+				willneed_left--;
+				vm_stat.willneed_cnt++;
+			}
+			break;
+		case MADV_DONTNEED:
+			/* File pages are kept, they are not anonymous memory. Untouched
+			 * or still in executable has nothing to release. Shared memory
+			 * is kept for other sharers. So is 2 MB mapping that could not
+			 * be split. */
+			if (VM_TYPE(page->operations->type) == VM_ANON && !page->is_shmem &&
+				!vm_on_zero_page(page) && !anon_in_origin(page) &&
+				pml4_split_page(page->pml4, page->va)) {
+				vm_release_page(page);
+			}
+			break;
+		default:
+			page->advice = advice;
+			break;
+		}
+	}
+	/* Access pattern on file mapping is given to the file for the mapped
+	 * range, so that reads of the file follow it too */
+	if (advice <= MADV_SEQUENTIAL && page_count &&
+		(file = vm_page_file(spt_find_page(spt, addr), &ofs))) {
+		inode_advise(file_get_inode(file), ofs, page_count * PGSIZE, advice);
+	}
+	return 0;
+}
+
 /* Free the page.
  * DO NOT MODIFY THIS FUNCTION. */
 /* Modified to free kva page */
@@ -381,20 +2498,101 @@ void vm_dealloc_page(struct page *page) {
 
 	destroy(page);
 	if (vm_on_phymem(page)) {
+		lock_acquire(&ft_lock);
+		/* Frame is moved by KSM or compaction only under ft_lock */
 		frame = vtof(page->kva);
-
-		lock_acquire(&frame->frame_lock);
+		frame_lock(frame);
 		list_remove(&page->page_elem);
 
-		if (list_empty(&frame->page_list)) {
+		if (list_empty(&frame->page_list) && !vm_on_zero_page(page)) {
+			lru_remove(frame);
+			text_cache_remove(frame);
 			palloc_free_page(ftov(frame));
 		}
-		lock_release(&frame->frame_lock);
+		if (!vm_on_zero_page(page)) {
+			vm_acct(page, -1, 0);
+		}
+		frame_unlock(frame);
+		lock_release(&ft_lock);
+		/* Fails only on exit, as madvise splits 2 MB mapping beforehand.
+		 * Then the mapping goes away with the whole pml4 */
 		pml4_clear_page(page->pml4, page->va);
+	} else if (!circular_is_alone(&page->page_elem)) {
+		/* Leave the sharers swapped out together */
+		lock_acquire(&ft_lock);
+		list_remove(&page->page_elem);
+		lock_release(&ft_lock);
 	}
 	free(page);
 }
 
+/* Allocate anonymous page at UPAGE whose content is ORIGIN in executable.
+ * The page is read from the file on fault, and dropped on eviction while
+ * clean. Read-only page is shared through text cache.
+ * On success ORIGIN is owned by the page. */
+bool vm_alloc_origin_page(void *upage, bool writable,
+						  struct vm_file_arg *origin) {
+	struct page *page;
+
+	if (!vm_alloc_page(VM_ANON, upage, writable)) {
+		return false;
+	}
+	page = spt_find_page(&thread_current()->spt, upage);
+	if (!anon_initializer(page, VM_ANON, NULL)) {
+		return false;
+	}
+	page->anon.origin = origin;
+	return true;
+}
+
+/* Map text PAGE to the frame in text cache holding the same content.
+ * Return false if there is no settled frame for it. */
+static bool vm_share_text_page(struct page *page) {
+	struct frame *frame;
+	bool is_shared = false;
+
+	ASSERT(circular_is_alone(&page->page_elem));
+
+	lock_acquire(&ft_lock);
+	frame = text_cache_find(page->anon.origin);
+	/* Frame being evicted holds frame_lock during its disk I/O */
+	if (frame && frame_trylock(frame)) {
+		if (!frame->is_claiming) {
+			page->kva = ftov(frame);
+			page->is_sharing = true;
+			page->evict_stamp = 0;
+			list_push_back(&frame->page_list, &page->page_elem);
+			if (!pml4_set_page(page->pml4, page->va, page->kva, false)) {
+				PANIC("I don't wan to write cod about pml4 fail");
+			}
+			is_shared = true;
+			vm_acct(page, 1, 0);
+			vm_stat.text_share_cnt++;
+		}
+		frame_unlock(frame);
+	}
+	lock_release(&ft_lock);
+	return is_shared;
+}
+
+/* Map PAGE which is brought in to a frame by its sharer, after the sharer
+ * is done with the frame. Return true to fault again if PAGE is evicted
+ * meanwhile. */
+static bool vm_map_sharer(struct page *page) {
+	void *kva = page->kva;
+	struct frame *frame = vtof(kva);
+
+	frame_pin(frame);
+	if (page->kva == kva && !pml4_get_page(page->pml4, page->va)) {
+		if (!pml4_set_page(page->pml4, page->va, kva, vm_writable(page))) {
+			PANIC("I don't wan to write cod about pml4 fail");
+		}
+		vm_acct(page, 1, 0);
+	}
+	frame_unpin(frame);
+	return true;
+}
+
 /* Claim the page that allocate on VA. */
 bool vm_claim_page(void *va) {
 	struct page *page;
@@ -412,64 +2610,109 @@ bool vm_claim_page(void *va) {
 /* Claim the PAGE and set up the mmu. */
 static bool vm_do_claim_page(struct page *page) {
 	struct frame *frame;
+	struct page *sharer;
 	uint64_t *pml4;
 	struct list_elem *cur_elem;
 
-	ASSERT(!vm_on_phymem(page));
+	/* Swapped in by a sharer before it is claimed */
+	if (vm_on_phymem(page)) {
+		return vm_map_sharer(page);
+	}
+	if (vm_is_text(page) && vm_share_text_page(page)) {
+		return true;
+	}
 
 	/* Check called in supplemental_page_table_copy */
 	if (VM_TYPE(page->operations->type) == VM_UNINIT &&
 		page->is_sharing) {
 		if (!swap_in(page, NULL)) {
-			PANIC("I don't wan to handdle swap in fail");
+			return false;
 		}
 		frame = vtof(page->kva);
 
-		ASSERT(frame->is_claiming != true);
+		/* Pinned by supplemental_page_table_copy */
+		ASSERT(frame->is_claiming == true);
 	} else {
-		frame = vm_get_frame();
-		if (!swap_in(page, ftov(frame))) {
-			PANIC("I don't wan to handdle swap in fail");
+		if (!(frame = vm_get_frame())) {
+			return false;
 		}
 
 		ASSERT(frame->is_claiming == true);
+
+		lock_acquire(&ft_lock);
+		/* Swapped in by a sharer while getting the frame */
+		if (vm_on_phymem(page)) {
+			lock_release(&ft_lock);
+			frame_unpin(frame);
+			palloc_free_page(ftov(frame));
+			return vm_map_sharer(page);
+		}
+		frame_lock(frame);
+		if (!circular_is_alone(&page->page_elem)) {
+			/* Evicted together with other sharers on one swap slot.
+			 * Bring all of them to this frame before reading the slot, so
+			 * that a sharer faulting meanwhile waits for this frame. */
+			for (cur_elem = list_next(&page->page_elem);
+				 cur_elem != &page->page_elem;
+				 cur_elem = list_next(cur_elem)) {
+				sharer = list_entry(cur_elem, struct page, page_elem);
+				anon_share_in(sharer, ftov(frame));
+				sharer->evict_stamp = 0;
+			}
+			circular_splice(&frame->page_list, &page->page_elem);
+		} else {
+			list_push_back(&frame->page_list, &page->page_elem);
+			/* Not shared from text cache until claiming is done */
+			if (vm_is_text(page)) {
+				text_cache_insert(frame, page);
+				vm_stat.text_load_cnt++;
+			}
+		}
+		frame_unlock(frame);
+		lock_release(&ft_lock);
+		if (!vm_swap_in(page, ftov(frame))) {
+			/* Swap slot is always read, so only sole page from a file
+			 * fails. The fault fails and kills only this process. */
+			lock_acquire(&ft_lock);
+			frame_lock(frame);
+			list_remove(&page->page_elem);
+			text_cache_remove(frame);
+
+			ASSERT(list_empty(&frame->page_list));
+
+			frame_set(frame, is_claiming, false);
+			frame_unlock(frame);
+			lock_release(&ft_lock);
+			palloc_free_page(ftov(frame));
+			return false;
+		}
+		lru_add(frame, page);
 	}
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-	/* Traversal circular list and add in pml4 */
-	if (circular_is_alone(&page->page_elem)) {
-		pml4 = page->pml4;
-
-		ASSERT(pml4_get_page(pml4, page->va) == NULL);
-		ASSERT(page->kva == ftov(frame));
-
-		if (!pml4_set_page(pml4, page->va, ftov(frame), vm_writable(page))) {
-			PANIC("I don't wan to write cod about pml4 fail");
-		}
-		lock_acquire(&frame->frame_lock);
-		list_push_back(&frame->page_list, &page->page_elem);
-		lock_release(&frame->frame_lock);
-	} else if (!list_empty(&frame->page_list)) {
-		for (cur_elem = list_begin(&frame->page_list);
-			 cur_elem != list_end(&frame->page_list);
-			 cur_elem = list_next(cur_elem)) {
-			page = list_entry(cur_elem, struct page, page_elem);
-			pml4 = page->pml4;
-
-			if (!pml4_get_page(pml4, page->va)) {
-				if (!pml4_set_page(pml4, page->va, ftov(frame), vm_writable(page))) {
-					PANIC("I don't wan to write cod about pml4 fail");
-				}
-			} else if (pml4_is_writable(pml4, page->va) != vm_writable(page)) {
-				pml4_set_writable(pml4, page->va, vm_writable(page));
+	/* Map every page on the frame which is not mapped yet */
+	frame_lock(frame);
+	for (cur_elem = list_begin(&frame->page_list);
+		 cur_elem != list_end(&frame->page_list);
+		 cur_elem = list_next(cur_elem)) {
+		sharer = list_entry(cur_elem, struct page, page_elem);
+		pml4 = sharer->pml4;
+
+		ASSERT(sharer->kva == ftov(frame));
+
+		if (!pml4_get_page(pml4, sharer->va)) {
+			if (!pml4_set_page(pml4, sharer->va, ftov(frame),
+							   vm_writable(sharer))) {
+				PANIC("I don't wan to write cod about pml4 fail");
 			}
+			vm_acct(sharer, 1, 0);
+		} else if (pml4_is_writable(pml4, sharer->va) != vm_writable(sharer)) {
+			pml4_set_writable(pml4, sharer->va, vm_writable(sharer));
 		}
-	} else {
-		PANIC("I didn't maid this case");
 	}
-	lock_acquire(&frame->frame_lock);
-	frame->is_claiming = false;
-	lock_release(&frame->frame_lock);
+	/* Sharer joining after this is mapped by itself */
+	frame_set(frame, is_claiming, false);
+	frame_unlock(frame);
 	return true;
 }
 
@@ -478,6 +2721,20 @@ void supplemental_page_table_init(struct supplemental_page_table *spt UNUSED) {
 	if (!hash_init(&spt->spt_hash, spt_hash_func, spt_less_func, NULL)) {
 		PANIC("spt hash init fail");
 	}
+	spt->rss = 0;
+	spt->rss_peak = 0;
+	spt->swap_cnt = 0;
+	spt->rss_limit = rss_limit_default;
+	spt->limit_hit_cnt = 0;
+	spt->oom_adj = 0;
+	spt->oom_killed = false;
+	spt->ws_size = 0;
+	spt->ws_peak = 0;
+	spt->ws_scan = 0;
+	spt->fault_clock = NULL;
+	spt->trace_va = NULL;
+	spt->trace_cnt = 0;
+	spt->prefetch_batch = NULL;
 }
 
 static bool copy_page(struct page *dst_page, void *_aux) {
@@ -485,21 +2742,105 @@ static bool copy_page(struct page *dst_page, void *_aux) {
 	void *va = dst_page->va;
 
 	ASSERT(dst_page->va == src_page->va);
-
-	if (!vm_on_phymem(src_page)) {
-		if (!vm_do_claim_page(src_page)) {
-			PANIC("src page swap in fail");
-			return false;
-		}
-	}
-
+	ASSERT(vm_on_phymem(src_page));
 	ASSERT(src_page->kva ==
 		   pml4_get_page(src_page->pml4, va));
 
 	dst_page->kva = src_page->kva;
 	src_page->is_sharing = true;
 
+	frame_lock(vtof(dst_page->kva));
 	list_insert(&src_page->page_elem, &dst_page->page_elem);
+	frame_unlock(vtof(dst_page->kva));
+	return true;
+}
+
+/* Duplicate ARG with its own reference to the file. */
+static struct vm_file_arg *vm_file_arg_dup(const struct vm_file_arg *arg) {
+	struct vm_file_arg *dup = malloc(sizeof(struct vm_file_arg));
+
+	if (!dup) {
+		return NULL;
+	}
+	*dup = *arg;
+	if (!(dup->file = file_plus_open_cnt(arg->file))) {
+		free(dup);
+		return NULL;
+	}
+	return dup;
+}
+
+/* Pin the frame of PAGE and return it. Return NULL if PAGE is not
+ * resident. */
+static struct frame *vm_pin_page(struct page *page) {
+	void *kva;
+
+	while (vm_on_phymem(page)) {
+		kva = page->kva;
+		frame_pin(vtof(kva));
+		if (page->kva == kva) {
+			return vtof(kva);
+		}
+		/* Evicted while waiting */
+		frame_unpin(vtof(kva));
+	}
+	return NULL;
+}
+
+/* Share non-resident SRC_PAGE with the forking process without bringing it
+ * into memory. Page not loaded yet copies its uninit descriptor, and swapped
+ * out anonymous page refers the same swap slot. */
+static bool copy_nonresident_page(struct page *src_page) {
+	void *va = src_page->va;
+	bool writable = src_page->writable;
+	struct page *dst_page;
+	struct frame *frame;
+
+	ASSERT(page_get_type(src_page) == VM_ANON);
+
+	if (VM_TYPE(src_page->operations->type) == VM_UNINIT) {
+		/* Only a page being copied by fork has aux, the page to copy from,
+		 * and it is claimed right away */
+		ASSERT(src_page->uninit.aux == NULL);
+		return vm_alloc_page_with_initializer(VM_ANON, va, writable,
+											  src_page->uninit.init, NULL);
+	}
+
+	if (!vm_alloc_page(VM_ANON, va, writable)) {
+		return false;
+	}
+	dst_page = spt_find_page(&thread_current()->spt, va);
+	if (!anon_initializer(dst_page, VM_ANON, NULL)) {
+		return false;
+	}
+	dst_page->is_shmem = src_page->is_shmem;
+
+	src_page->is_sharing = true;
+	dst_page->is_sharing = true;
+	/* Sharer of the swap slot may swap it in until ft_lock is taken */
+	for (;;) {
+		if ((frame = vm_pin_page(src_page))) {
+			/* Swapped in meanwhile, share the frame instead */
+			frame_lock(frame);
+			dst_page->kva = src_page->kva;
+			list_insert(&src_page->page_elem, &dst_page->page_elem);
+			if (!pml4_set_page(dst_page->pml4, va, dst_page->kva, false)) {
+				PANIC("I don't wan to write cod about pml4 fail");
+			}
+			vm_acct(dst_page, 1, 0);
+			frame_unlock(frame);
+			frame_unpin(frame);
+			return true;
+		}
+		lock_acquire(&ft_lock);
+		if (!vm_on_phymem(src_page)) {
+			break;
+		}
+		lock_release(&ft_lock);
+	}
+	anon_share_swap(dst_page, src_page);
+	list_insert(&src_page->page_elem, &dst_page->page_elem);
+	lock_release(&ft_lock);
 	return true;
 }
 
@@ -507,10 +2848,15 @@ static bool copy_page(struct page *dst_page, void *_aux) {
 bool supplemental_page_table_copy(struct supplemental_page_table *dst,
 								  struct supplemental_page_table *src) {
 	struct page *src_page, *dst_page;
+	struct frame *frame;
 	enum vm_type src_type;
+	struct vm_file_arg *arg;
 	void *src_va;
 	bool src_writable;
 	struct hash_iterator current_i;
+
+	dst->rss_limit = src->rss_limit;
+	dst->oom_adj = src->oom_adj;
 	hash_first(&current_i, &src->spt_hash);
 	while (hash_next(&current_i)) {
 		src_page = hash_entry(hash_cur(&current_i), struct page, spt_elem);
@@ -519,17 +2865,57 @@ bool supplemental_page_table_copy(struct supplemental_page_table *dst,
 			continue;
 		}
 		src_va = src_page->va;
-		src_writable = vm_writable(src_page);
+		src_writable = src_page->writable;
+		/* Text is shared through text cache rather than by fork, and page
+		 * still same as the executable is read from it */
+		if (vm_is_text(src_page) || anon_in_origin(src_page)) {
+			if (!(arg = vm_file_arg_dup(src_page->anon.origin))) {
+				return false;
+			}
+			if (!vm_alloc_origin_page(src_va, src_writable, arg)) {
+				file_close(arg->file);
+				free(arg);
+				return false;
+			}
+			continue;
+		}
+		/* Zero page is shared already, child starts with untouched page */
+		if (vm_on_phymem(src_page) && vm_on_zero_page(src_page)) {
+			if (!vm_alloc_page(VM_ANON, src_va, src_writable)) {
+				return false;
+			}
+			continue;
+		}
+		/* Fork does not depend on how much of parent is swapped out */
+		if (!(frame = vm_pin_page(src_page))) {
+			if (!copy_nonresident_page(src_page)) {
+				return false;
+			}
+			continue;
+		}
+		/* FRAME is unpinned when vm_do_claim_page maps the child */
 		if (!vm_alloc_page_with_initializer(src_type, src_va, src_writable,
 											copy_page, src_page)) {
+			frame_unpin(frame);
 			return false;
 		}
 		dst_page = spt_find_page(dst, src_va);
 		dst_page->is_sharing = true;
+		dst_page->is_shmem = src_page->is_shmem;
 		if (!vm_do_claim_page(dst_page)) {
+			frame_unpin(frame);
 			return false;
 		}
 	}
+	/* Access pattern hints are inherited */
+	hash_first(&current_i, &src->spt_hash);
+	while (hash_next(&current_i)) {
+		src_page = hash_entry(hash_cur(&current_i), struct page, spt_elem);
+		if (src_page->advice != MADV_NORMAL &&
+			(dst_page = spt_find_page(dst, src_page->va))) {
+			dst_page->advice = src_page->advice;
+		}
+	}
 	return true;
 }
 
@@ -538,6 +2924,14 @@ void supplemental_page_table_kill(struct supplemental_page_table *spt) {
 	/* TODO: Destroy all the supplemental_page_table hold by thread and
 	 * TODO: writeback all the modified contents to the storage. */
 	hash_clear(&spt->spt_hash, spt_destroy_func);
+	vm_trace_finish(spt);
+	/* Memory of killed process is freed, OOM killer may run again */
+	lock_acquire(&acct_lock);
+	if (spt->oom_killed) {
+		spt->oom_killed = false;
+		oom_pending--;
+	}
+	lock_release(&acct_lock);
 }
 
 /* Destroy supplemental page helper function */
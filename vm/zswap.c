@@ -0,0 +1,422 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk.
+ *
+ * Swapped out anonymous page is compressed and kept in kernel memory, keyed
+ * by the swap slot already allocated for it. The slot is only written when
+ * the page compresses poorly or when the pool is full and the entry is in
+ * the coldest pool page.
+ *
+ * Compressed pages are packed zbud style, at most two per pool page: the
+ * first buddy from the start of the page and the last buddy from its end.
+ * Pool pages come from the kernel pool while it is not short of pages, and
+ * the pool is limited by pages it really holds. */
+
+#include "vm/zswap.h"
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+#include "vm/shrinker.h"
+
+/* Compressed page bigger than this goes straight to the swap disk. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* Compressor parameters. A match is encoded in 2 bytes with 12 bit offset
+ * and 4 bit length. */
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 15)
+#define LZ_MAX_OFFSET 4095
+
+/* Pool page holding up to two compressed pages. */
+struct zbud_page {
+	struct list_elem elem;			/* In zbud_unbuddied if one is free */
+	struct zswap_entry *buddy[2];	/* First and last buddy */
+};
+
+/* Compressed page stored in the pool. */
+struct zswap_entry {
+	disk_sector_t sec_no;
+	uint16_t len;
+	uint8_t side;					/* Index in zpage->buddy */
+	bool writeback;					/* Being written back, not in LRU */
+	struct zbud_page *zpage;
+	struct hash_elem z_elem;
+	struct list_elem lru_elem;
+};
+
+size_t zswap_max_percent;
+
+static struct hash zswap_hash;
+/* Most recently stored at front. */
+static struct list zswap_lru;
+/* Pool pages with a free buddy */
+static struct list zbud_unbuddied;
+static struct lock zswap_lock;
+/* Held while writing back, taken before zswap_lock. zswap_lock is
+ * released during the disk write. */
+static struct lock zswap_wb_lock;
+/* Signaled under zswap_lock when a writeback is done */
+static struct condition zswap_wb_done;
+static zswap_writeback_func *zswap_writeback;
+/* Pool pages in use and maximum */
+static size_t pool_pages;
+static size_t pool_limit;
+/* Buffers used under zswap_lock */
+static uint8_t *zbuf;
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+/* Buffer used under zswap_wb_lock */
+static uint8_t *wbuf;
+
+static struct {
+	uint64_t store_cnt;
+	uint64_t reject_cnt;
+	uint64_t load_cnt;
+	uint64_t writeback_cnt;
+	uint64_t stored_bytes;
+} zswap_stat;
+
+static uint64_t zswap_hash_func(const struct hash_elem *e, void *aux UNUSED) {
+	struct zswap_entry *entry = hash_entry(e, struct zswap_entry, z_elem);
+	return hash_int(entry->sec_no);
+}
+
+static bool zswap_less_func(const struct hash_elem *a,
+							const struct hash_elem *b, void *aux UNUSED) {
+	struct zswap_entry *entry_a = hash_entry(a, struct zswap_entry, z_elem);
+	struct zswap_entry *entry_b = hash_entry(b, struct zswap_entry, z_elem);
+	return entry_a->sec_no < entry_b->sec_no;
+}
+
+#define ZBUD_FREE (PGSIZE - sizeof(struct zbud_page))
+#define zbud_data(entry)                                                      \
+	((entry)->side ? (uint8_t *)(entry)->zpage + PGSIZE - (entry)->len       \
+				   : (uint8_t *)((entry)->zpage + 1))
+#define lz_hash(p) \
+	((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) & ((1 << LZ_HASH_BITS) - 1))
+
+/* Compress SRC of SRC_LEN bytes into DST of DST_CAP bytes with LZ77.
+ * Every 8 items are preceded by a control byte, set bit means 2 byte match
+ * and clear bit means literal byte. Return compressed length, 0 if it does
+ * not fit in DST. */
+static size_t lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst,
+						  size_t dst_cap) {
+	size_t ip = 0, op = 0, ctrl_pos;
+	size_t cand, len, off;
+	uint8_t ctrl;
+	int bit;
+
+	while (ip < src_len) {
+		if (op + 1 + 8 * 2 > dst_cap) {
+			return 0;
+		}
+		ctrl_pos = op++;
+		ctrl = 0;
+		for (bit = 0; bit < 8 && ip < src_len; ++bit) {
+			if (ip + LZ_MIN_MATCH <= src_len) {
+				/* Stale entry from other page is filtered by comparing */
+				cand = lz_table[lz_hash(src + ip)];
+				lz_table[lz_hash(src + ip)] = ip;
+				off = ip - cand;
+				if (cand < ip && off <= LZ_MAX_OFFSET &&
+					!memcmp(src + cand, src + ip, LZ_MIN_MATCH)) {
+					len = LZ_MIN_MATCH;
+					while (len < LZ_MAX_MATCH && ip + len < src_len &&
+						   src[cand + len] == src[ip + len]) {
+						len++;
+					}
+					dst[op++] = off >> 4;
+					dst[op++] = ((off & 0xf) << 4) | (len - LZ_MIN_MATCH);
+					ctrl |= 1 << bit;
+					ip += len;
+					continue;
+				}
+			}
+			dst[op++] = src[ip++];
+		}
+		dst[ctrl_pos] = ctrl;
+	}
+	return op;
+}
+
+/* Decompress SRC of SRC_LEN bytes into DST of DST_LEN bytes.
+ * Return false on corrupted input. */
+static bool lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst,
+						  size_t dst_len) {
+	size_t ip = 0, op = 0, len, off;
+	uint8_t ctrl;
+	int bit;
+
+	while (ip < src_len) {
+		ctrl = src[ip++];
+		for (bit = 0; bit < 8 && ip < src_len; ++bit) {
+			if (ctrl & (1 << bit)) {
+				if (ip + 2 > src_len) {
+					return false;
+				}
+				off = (src[ip] << 4) | (src[ip + 1] >> 4);
+				len = (src[ip + 1] & 0xf) + LZ_MIN_MATCH;
+				ip += 2;
+				if (off == 0 || off > op || op + len > dst_len) {
+					return false;
+				}
+				/* Byte by byte, match may overlap itself */
+				for (; len > 0; --len, ++op) {
+					dst[op] = dst[op - off];
+				}
+			} else {
+				if (op >= dst_len) {
+					return false;
+				}
+				dst[op++] = src[ip++];
+			}
+		}
+	}
+	return op == dst_len;
+}
+
+/* Find entry for SEC_NO. Need zswap_lock before call this */
+static struct zswap_entry *zswap_find(disk_sector_t sec_no) {
+	struct zswap_entry key = {.sec_no = sec_no};
+	struct hash_elem *e = hash_find(&zswap_hash, &key.z_elem);
+	return e ? hash_entry(e, struct zswap_entry, z_elem) : NULL;
+}
+
+/* Place LEN bytes of ENTRY in a pool page with enough free space, or in a
+ * new page if the pool may grow. Need zswap_lock before call this */
+static bool zbud_alloc(struct zswap_entry *entry, size_t len) {
+	struct zbud_page *zp = NULL;
+	struct list_elem *e;
+	size_t used;
+
+	for (e = list_begin(&zbud_unbuddied); e != list_end(&zbud_unbuddied);
+		 e = list_next(e)) {
+		zp = list_entry(e, struct zbud_page, elem);
+		used = zp->buddy[0] ? zp->buddy[0]->len : zp->buddy[1]->len;
+		if (used + len <= ZBUD_FREE) {
+			list_remove(&zp->elem);
+			break;
+		}
+		zp = NULL;
+	}
+	if (zp == NULL) {
+		if (pool_pages >= pool_limit || palloc_kernel_shortage() ||
+			!(zp = palloc_get_page(0))) {
+			return false;
+		}
+		zp->buddy[0] = zp->buddy[1] = NULL;
+		list_push_back(&zbud_unbuddied, &zp->elem);
+		pool_pages++;
+	}
+	entry->side = zp->buddy[0] != NULL;
+	entry->len = len;
+	entry->zpage = zp;
+	zp->buddy[entry->side] = entry;
+	return true;
+}
+
+/* Release space of ENTRY in its pool page, and the page if it is the last
+ * one. Need zswap_lock before call this */
+static void zbud_free(struct zswap_entry *entry) {
+	struct zbud_page *zp = entry->zpage;
+
+	zp->buddy[entry->side] = NULL;
+	if (!zp->buddy[0] && !zp->buddy[1]) {
+		list_remove(&zp->elem);
+		palloc_free_page(zp);
+		pool_pages--;
+	} else {
+		/* Was full */
+		list_push_back(&zbud_unbuddied, &zp->elem);
+	}
+}
+
+/* Remove ENTRY from the pool and free it. Need zswap_lock before call this */
+static void zswap_remove(struct zswap_entry *entry) {
+	hash_delete(&zswap_hash, &entry->z_elem);
+	if (!entry->writeback) {
+		list_remove(&entry->lru_elem);
+	}
+	zbud_free(entry);
+	free(entry);
+}
+
+/* Write every entry of the pool page of coldest entry back to the swap disk
+ * and free the page. Entries stay loadable until written.
+ * Need zswap_wb_lock and zswap_lock before call this, zswap_lock is
+ * released while writing. */
+static void zswap_writeback_coldest(void) {
+	struct zswap_entry *entry, *buddy[2];
+	struct zbud_page *zp;
+
+	ASSERT(!list_empty(&zswap_lru));
+	entry = list_entry(list_back(&zswap_lru), struct zswap_entry, lru_elem);
+	zp = entry->zpage;
+	for (int i = 0; i < 2; ++i) {
+		if ((buddy[i] = zp->buddy[i])) {
+			buddy[i]->writeback = true;
+			list_remove(&buddy[i]->lru_elem);
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (!(entry = buddy[i])) {
+			continue;
+		}
+		if (!lz_decompress(zbud_data(entry), entry->len, wbuf, PGSIZE)) {
+			PANIC("zswap entry of sector %u is corrupted", entry->sec_no);
+		}
+		lock_release(&zswap_lock);
+		zswap_writeback(entry->sec_no, wbuf);
+		lock_acquire(&zswap_lock);
+		zswap_remove(entry);
+		zswap_stat.writeback_cnt++;
+	}
+	cond_broadcast(&zswap_wb_done, &zswap_lock);
+}
+
+static size_t zswap_shrink_count(void) {
+	return pool_pages;
+}
+
+/* Write back coldest pool pages, NR_PAGES at most. Skipped if the pool is
+ * busy. */
+static void zswap_shrink_scan(size_t nr_pages) {
+	if (lock_held_by_current_thread(&zswap_wb_lock) ||
+		!lock_try_acquire(&zswap_wb_lock)) {
+		return;
+	}
+	if (lock_held_by_current_thread(&zswap_lock) ||
+		!lock_try_acquire(&zswap_lock)) {
+		lock_release(&zswap_wb_lock);
+		return;
+	}
+	while (nr_pages-- > 0 && !list_empty(&zswap_lru)) {
+		zswap_writeback_coldest();
+	}
+	lock_release(&zswap_lock);
+	lock_release(&zswap_wb_lock);
+}
+
+static struct shrinker zswap_shrinker = {
+	.name = "zswap",
+	.count = zswap_shrink_count,
+	.scan = zswap_shrink_scan,
+};
+
+/* Initialize compressed pool. WRITEBACK writes a page to its swap slot. */
+void zswap_init(zswap_writeback_func *writeback) {
+	zswap_writeback = writeback;
+	pool_limit = user_page_no * zswap_max_percent / 100;
+	if (!hash_init(&zswap_hash, zswap_hash_func, zswap_less_func, NULL)) {
+		PANIC("zswap hash init fail");
+	}
+	list_init(&zswap_lru);
+	list_init(&zbud_unbuddied);
+	lock_init(&zswap_lock);
+	lock_init(&zswap_wb_lock);
+	cond_init(&zswap_wb_done);
+	if (pool_limit &&
+		(!(zbuf = palloc_get_page(0)) || !(wbuf = palloc_get_page(0)))) {
+		PANIC("zswap buffer init fail");
+	}
+	if (pool_limit) {
+		shrinker_register(&zswap_shrinker);
+	}
+}
+
+/* Compress page at KVA into the pool as content of swap slot SEC_NO.
+ * Return false if the page should be written to the swap disk instead. */
+bool zswap_store(disk_sector_t sec_no, const void *kva) {
+	struct zswap_entry *entry;
+	size_t len;
+	bool stored;
+
+	if (!pool_limit) {
+		return false;
+	}
+	entry = malloc(sizeof(struct zswap_entry));
+	lock_acquire(&zswap_lock);
+	ASSERT(zswap_find(sec_no) == NULL);
+
+	len = entry ? lz_compress(kva, PGSIZE, zbuf, ZSWAP_MAX_LEN) : 0;
+	stored = len && zbud_alloc(entry, len);
+	if (len && !stored && !list_empty(&zswap_lru)) {
+		/* Pool is full. Free the coldest pool page, zbuf may be used by
+		 * others while writing so compress again. */
+		lock_release(&zswap_lock);
+		lock_acquire(&zswap_wb_lock);
+		lock_acquire(&zswap_lock);
+		if (!list_empty(&zswap_lru)) {
+			zswap_writeback_coldest();
+		}
+		lock_release(&zswap_wb_lock);
+		len = lz_compress(kva, PGSIZE, zbuf, ZSWAP_MAX_LEN);
+		stored = len && zbud_alloc(entry, len);
+	}
+	if (!stored) {
+		zswap_stat.reject_cnt++;
+		lock_release(&zswap_lock);
+		free(entry);
+		return false;
+	}
+	entry->sec_no = sec_no;
+	entry->writeback = false;
+	memcpy(zbud_data(entry), zbuf, len);
+	hash_insert(&zswap_hash, &entry->z_elem);
+	list_push_front(&zswap_lru, &entry->lru_elem);
+	zswap_stat.store_cnt++;
+	zswap_stat.stored_bytes += len;
+	lock_release(&zswap_lock);
+	return true;
+}
+
+/* Load content of swap slot SEC_NO into KVA if it is in the pool.
+ * The entry is kept until the slot is freed. */
+bool zswap_load(disk_sector_t sec_no, void *kva) {
+	struct zswap_entry *entry;
+
+	if (!pool_limit) {
+		return false;
+	}
+	lock_acquire(&zswap_lock);
+	entry = zswap_find(sec_no);
+	if (entry) {
+		if (!lz_decompress(zbud_data(entry), entry->len, kva, PGSIZE)) {
+			PANIC("zswap entry of sector %u is corrupted", sec_no);
+		}
+		zswap_stat.load_cnt++;
+	}
+	lock_release(&zswap_lock);
+	return entry != NULL;
+}
+
+/* Forget content of swap slot SEC_NO, called when the slot is freed.
+ * Waits for its writeback, so that a reused slot is not overwritten. */
+void zswap_invalidate(disk_sector_t sec_no) {
+	struct zswap_entry *entry;
+
+	if (!pool_limit) {
+		return;
+	}
+	lock_acquire(&zswap_lock);
+	while ((entry = zswap_find(sec_no)) && entry->writeback) {
+		cond_wait(&zswap_wb_done, &zswap_lock);
+	}
+	if (entry) {
+		zswap_remove(entry);
+	}
+	lock_release(&zswap_lock);
+}
+
+/* Prints compressed pool statistics. */
+void zswap_print_stats(void) {
+	printf("zswap: %llu stored (%llu bytes), %llu rejected, %llu loaded, "
+		   "%llu written back, %zu pool pages\n",
+		   zswap_stat.store_cnt, zswap_stat.stored_bytes,
+		   zswap_stat.reject_cnt, zswap_stat.load_cnt,
+		   zswap_stat.writeback_cnt, pool_pages);
+}